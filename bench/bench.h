@@ -0,0 +1,41 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <time.h>
+
+extern unsigned long bench_requests;
+
+
+//*********************************
+//        BENCH FUNCTIONS
+//*********************************
+double elapsed_nsec(struct timespec* start);
+
+
+//*********************************
+//        MESH FUNCTIONS
+//*********************************
+int init_mesh(int workers);
+void mesh_onion(int i, char* onion_id);
+void grow_mesh(int size);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file bench_header.c
+ *  Measures the cost of decode_header() over the header lines of a
+ *  corpus of text messages. The same source is built against the decoder
+ *  of this tree and, with BASELINE defined, against the decoder of the
+ *  baseline revision, which rebuilt the header table and copied every
+ *  line, so that both can be compared.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dchat_h/types.h"
+#include "dchat_h/decoder.h"
+#include "dchat_h/consoleui.h"
+#include "bench.h"
+
+#define CORPUS_PDUS  10000 // PDUs of the corpus
+#define PARSE_ROUNDS 50    // decodes of the corpus
+#define PDU_HEADERS  7     // header lines per PDU
+
+#ifdef BASELINE
+#define DECODE_HEADER(PDU, LINE, LEN) decode_header(PDU, LINE)
+#define DECODER_NAME "baseline"
+#else
+#define DECODE_HEADER(PDU, LINE, LEN) decode_header(PDU, LINE, LEN)
+#define DECODER_NAME "current"
+#endif
+
+
+/**
+ *  Records the header lines of a corpus of text messages as they are sent
+ *  to legacy peers. Every line is \\n and \\0 terminated.
+ *  @param off Receives the offsets of the lines
+ *  @param len Receives the length of the corpus
+ *  @return corpus allocated on the heap
+ */
+char*
+record_headers(int* off, int* len)
+{
+    char* corpus;
+    int size = CORPUS_PDUS * PDU_HEADERS * 64;
+    int n = 0;
+
+    if ((corpus = malloc(size)) == NULL)
+    {
+        ui_fatal("Memory allocation for corpus failed!");
+    }
+
+    *len = 0;
+
+    for (int i = 0; i < CORPUS_PDUS; i++)
+    {
+        const char* fmt[PDU_HEADERS] =
+        {
+            "Content-Type: text/plain\n",
+            "Content-Length: %d\n",
+            "Host: aaaaaaaaaaaaaaaa.onion\n",
+            "Listen-Port: 7777\n",
+            "Nickname: alice\n",
+            "Date: Fri, 16 Oct 2026 19:33:11 GMT\n",
+            "Server: dchat/0.2 (digest binlist frame session)\n"
+        };
+
+        for (int h = 0; h < PDU_HEADERS; h++)
+        {
+            off[n++] = *len;
+            *len += snprintf(corpus + *len, size - *len, fmt[h], 10 + i % 200) + 1;
+        }
+    }
+
+    return corpus;
+}
+
+
+int
+main()
+{
+    static int off[CORPUS_PDUS * PDU_HEADERS]; // offsets of header lines
+    double nsec[PDU_HEADERS] = { 0 };          // time per kind of header
+    double total = 0;
+    struct timespec start;
+    dchat_pdu_t pdu;
+    char* corpus;
+    char* buf;
+    char* line;
+    char* key;
+    int len;
+
+    corpus = record_headers(off, &len);
+
+    // the current decoder parses in place
+    if ((buf = malloc(len)) == NULL)
+    {
+        ui_fatal("Memory allocation for header lines failed!");
+    }
+
+    memset(&pdu, 0, sizeof(pdu));
+
+    for (int r = 0; r < PARSE_ROUNDS; r++)
+    {
+        memcpy(buf, corpus, len);
+
+        // every kind of header is measured on its own
+        for (int h = 0; h < PDU_HEADERS; h++)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+
+            for (int i = 0; i < CORPUS_PDUS; i++)
+            {
+                line = buf + off[i * PDU_HEADERS + h];
+
+                if (DECODE_HEADER(&pdu, line, strlen(line)) == -1)
+                {
+                    ui_fatal("Decoding of header '%s' failed!", line);
+                }
+
+                // the server is allocated
+                free_pdu(&pdu);
+                pdu.server = NULL;
+            }
+
+            nsec[h] += elapsed_nsec(&start);
+        }
+    }
+
+    printf("%-8s", DECODER_NAME);
+
+    for (int h = 0; h < PDU_HEADERS; h++)
+    {
+        // print key of header, the line itself may have been modified
+        key = corpus + off[h];
+        printf(" %.*s %.1f", (int) (strchr(key, ':') - key), key,
+               nsec[h] / PARSE_ROUNDS / CORPUS_PDUS);
+        total += nsec[h];
+    }
+
+    printf(" | %.1f ns/pdu\n", total / PARSE_ROUNDS / CORPUS_PDUS);
+    free(buf);
+    free(corpus);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,212 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file bench_join.c
+ *  Measures the traffic of a peer joining a mesh of 10 to 10000 contacts.
+ *  A legacy peer gets the whole contactlist as text. A peer supporting
+ *  digests and binary contactlists exchanges digests first and gets the
+ *  contacts missing in its digest only: a new peer knows none of them,
+ *  a peer rejoining after a short disconnect knows all of them. The bytes
+ *  sent in both directions are counted.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "dchat_h/types.h"
+#include "dchat_h/contact.h"
+#include "dchat_h/decoder.h"
+#include "dchat_h/network.h"
+#include "dchat_h/consoleui.h"
+#include "bench.h"
+
+#define JOIN_MAX    10000 // largest mesh
+#define JOIN_LEGACY 0     // peer without capabilities
+#define JOIN_NEW    1     // peer supporting digests, knows no contact
+#define JOIN_REJOIN 2     // peer supporting digests, knows all contacts
+
+
+/**
+ *  Builds the digest a joining peer sends, it holds the peer itself and
+ *  the first `known` contacts of the mesh.
+ *  @see send_digest()
+ *  @param known Amount of contacts known to the peer
+ *  @param len   Receives the length of the digest
+ *  @return digest allocated on the heap
+ */
+unsigned char*
+peer_digest(int known, int* len)
+{
+    unsigned char* digest;
+    char onion_id[ONION_ADDRLEN + 1];
+    unsigned b;
+
+    *len = ((known + 1) * DIGEST_BITS + 7) / 8;
+    *len = *len < DIGEST_MIN ? DIGEST_MIN : *len > content_limit(CTT_ID_DGT) ?
+           content_limit(CTT_ID_DGT) : *len;
+
+    if ((digest = calloc(*len, 1)) == NULL)
+    {
+        ui_fatal("Memory allocation for digest failed!");
+    }
+
+    for (int c = -1; c < known; c++)
+    {
+        if (c == -1)
+        {
+            strcpy(onion_id, "cccccccccccccccc.onion");
+        }
+        else
+        {
+            mesh_onion(c, onion_id);
+        }
+
+        for (int i = 0; i < DIGEST_HASHES; i++)
+        {
+            b = digest_bit(onion_id, 7777, i, *len * 8);
+            digest[b / 8] |= 1 << (b % 8);
+        }
+    }
+
+    return digest;
+}
+
+
+/**
+ *  Writes the send queue of the joining peer and reads what has been
+ *  sent on the other end of its socket.
+ *  @param wk   Worker owning the peer
+ *  @param n    Index of the peer
+ *  @param peer Socket of the peer
+ *  @return amount of bytes received by the peer
+ */
+long
+receive_join(worker_t* wk, int n, int peer)
+{
+    char buf[65536];
+    long bytes = 0;
+    int ret;
+
+    do
+    {
+        if (flush_contact(wk, CONTACT(wk, n)) == -1)
+        {
+            ui_fatal("Sending to joining peer failed!");
+        }
+
+        while ((ret = recv(peer, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        {
+            bytes += ret;
+        }
+    }
+    while (CONTACT(wk, n)->oq.cnt);
+
+    return bytes;
+}
+
+
+/**
+ *  Lets a peer join the mesh through the first worker.
+ *  @param type JOIN_LEGACY, JOIN_NEW or JOIN_REJOIN
+ *  @param size Amount of contacts of the mesh
+ *  @return bytes sent in both directions
+ */
+long
+join_mesh(int type, int size)
+{
+    worker_t* wk = &_cnf->wk[0];
+    contact_t* contact;
+    unsigned char* digest;
+    long bytes;
+    int sv[2];
+    int len;
+    int n;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1 || set_nonblocking(sv[0]) == -1)
+    {
+        ui_fatal("Creation of socket of joining peer failed!");
+    }
+
+    if ((n = add_contact(wk, sv[0])) == -1)
+    {
+        ui_fatal("Adding of joining peer failed!");
+    }
+
+    contact = CONTACT(wk, n);
+    strcpy(contact->onion_id, "cccccccccccccccc.onion");
+    contact->lport = 7777;
+    contact->accepted = 1;
+    index_contact(wk, n);
+    wk->dir_dirty = 1;
+
+    if (type == JOIN_LEGACY)
+    {
+        contact->caps = CAP_KNOWN;
+        send_contacts(wk, n, NULL, 0);
+        bytes = receive_join(wk, n, sv[1]);
+    }
+    else
+    {
+        // we send our digest, the peer answers with its own one and
+        // gets the contacts it is missing
+        contact->caps = CAP_KNOWN | CAP_DIGEST | CAP_BINLIST;
+        send_digest(wk, n);
+        digest = peer_digest(type == JOIN_REJOIN ? size : 0, &len);
+        send_contacts(wk, n, digest, len);
+        bytes = receive_join(wk, n, sv[1]) + len;
+        free(digest);
+    }
+
+    del_contact(wk, n);
+    close(sv[1]);
+    return bytes;
+}
+
+
+int
+main()
+{
+    int limit;
+
+    limit = init_mesh(1);
+    printf("%8s %12s %12s %12s\n", "contacts", "legacy(B)", "new(B)", "rejoin(B)");
+
+    for (int size = 10; size <= JOIN_MAX; size *= 10)
+    {
+        if (size > limit)
+        {
+            printf("mesh of %d contacts exceeds the limit of open files\n", size);
+            break;
+        }
+
+        grow_mesh(size);
+        printf("%8d %12ld %12ld %12ld\n", size, join_mesh(JOIN_LEGACY, size),
+               join_mesh(JOIN_NEW, size), join_mesh(JOIN_REJOIN, size));
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,167 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file bench_mesh.c
+ *  Grows a mesh from 10 to 10000 contacts shared by two workers and
+ *  measures at every size the cost of adding a contact, of publishing
+ *  the directories, of looking up a contact and of receiving a
+ *  "control/discover" PDU listing the whole mesh. Lookups of the contacts
+ *  of the second worker go through its published directory.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dchat_h/types.h"
+#include "dchat_h/contact.h"
+#include "dchat_h/decoder.h"
+#include "dchat_h/consoleui.h"
+#include "bench.h"
+
+#define MESH_WORKERS 2     // workers sharing the mesh
+#define MESH_MAX     10000 // largest mesh
+
+
+/**
+ *  Looks up every contact of the mesh from the first worker.
+ *  @param size Amount of contacts
+ *  @return nanoseconds per lookup
+ */
+double
+lookup_mesh(int size)
+{
+    struct timespec start;
+    contact_t contact;
+    int found = 0;
+
+    memset(&contact, 0, sizeof(contact));
+    contact.lport = 7777;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < size; i++)
+    {
+        mesh_onion(i, contact.onion_id);
+        found += locate_contact(&_cnf->wk[0], &contact, NULL, NULL) != NULL;
+    }
+
+    if (found != size)
+    {
+        ui_fatal("Only %d of %d contacts found!", found, size);
+    }
+
+    return elapsed_nsec(&start) / size;
+}
+
+
+/**
+ *  Passes a "control/discover" PDU listing the whole mesh to the first
+ *  worker, as it is received from a legacy peer joining the mesh.
+ *  @param size Amount of contacts
+ *  @return nanoseconds per listed contact
+ */
+double
+discover_mesh(int size)
+{
+    struct timespec start;
+    dchat_pdu_t pdu;
+    contact_t contact;
+    char* line;
+    double nsec;
+    int len = 0;
+
+    memset(&pdu, 0, sizeof(pdu));
+    memset(&contact, 0, sizeof(contact));
+    pdu.content_type = CTT_ID_DSC;
+    contact.lport = 7777;
+
+    for (int i = 0; i < size; i++)
+    {
+        mesh_onion(i, contact.onion_id);
+
+        if ((line = contact_to_string(&contact)) == NULL ||
+            (pdu.content = realloc(pdu.content, len + strlen(line))) == NULL)
+        {
+            ui_fatal("Creation of contactlist failed!");
+        }
+
+        memcpy(pdu.content + len, line, strlen(line));
+        len += strlen(line);
+        free(line);
+    }
+
+    pdu.content_length = len;
+    bench_requests = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (receive_contacts(&_cnf->wk[0], &pdu) == -1 || bench_requests)
+    {
+        ui_fatal("Known contacts have not been recognized!");
+    }
+
+    nsec = elapsed_nsec(&start);
+    free(pdu.content);
+    return nsec / size;
+}
+
+
+int
+main()
+{
+    struct timespec start;
+    double add, publish;
+    int limit;
+    int size, prev = 0;
+
+    limit = init_mesh(MESH_WORKERS);
+    printf("%8s %10s %12s %10s %12s\n", "contacts", "add(ns)", "publish(us)",
+           "lookup(ns)", "discover(ns)");
+
+    for (size = 10; size <= MESH_MAX; size *= 10)
+    {
+        if (size > limit)
+        {
+            printf("mesh of %d contacts exceeds the limit of open files\n", size);
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        grow_mesh(size);
+        add = elapsed_nsec(&start) / (size - prev);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (int w = 0; w < MESH_WORKERS; w++)
+        {
+            sync_directory(&_cnf->wk[w]);
+        }
+
+        publish = elapsed_nsec(&start) / 1e3;
+        printf("%8d %10.1f %12.1f %10.1f %12.1f\n", size, add, publish,
+               lookup_mesh(size), discover_mesh(size));
+        prev = size;
+    }
+
+    return EXIT_SUCCESS;
+}
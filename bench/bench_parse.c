@@ -0,0 +1,176 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file bench_parse.c
+ *  Measures the cost of parsing PDUs with next_pdu(). A corpus of text
+ *  messages is recorded with the encoders of the daemon as it is sent
+ *  to legacy peers (identity in every PDU), to peers in session mode and
+ *  as binary frames. Every corpus is parsed from memory, so that neither
+ *  recv(2) nor the handling of the PDUs is measured.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dchat_h/types.h"
+#include "dchat_h/decoder.h"
+#include "dchat_h/consoleui.h"
+#include "bench.h"
+
+#define CORPUS_PDUS  10000 // PDUs per corpus
+#define PARSE_ROUNDS 50    // parses of every corpus
+#define CORPUS_PLAIN   0   // identity in every text PDU
+#define CORPUS_SESSION 1   // identity in the first text PDU only
+#define CORPUS_FRAME   2   // binary frames
+
+
+/**
+ *  Records a corpus of text messages of varying length.
+ *  @param type CORPUS_PLAIN, CORPUS_SESSION or CORPUS_FRAME
+ *  @param len  Receives the length of the corpus
+ *  @return corpus allocated on the heap
+ */
+char*
+record_corpus(int type, int* len)
+{
+    dchat_pdu_t pdu;    // recorded PDU
+    wire_buf_t* wb;     // encoded PDU
+    char msg[256];      // content of PDU
+    char* corpus = NULL;
+    int i;
+    *len = 0;
+
+    for (i = 0; i < CORPUS_PDUS; i++)
+    {
+        init_dchat_pdu(&pdu, 1.0, CTT_ID_TXT, "aaaaaaaaaaaaaaaa.onion", 7777, "alice");
+        snprintf(msg, sizeof(msg), "message %d %.*s", i, i % 200,
+                 "the quick brown fox jumps over the lazy dog, the quick brown fox "
+                 "jumps over the lazy dog, the quick brown fox jumps over the lazy "
+                 "dog, the quick brown fox jumps over the lazy dog");
+        init_dchat_pdu_content(&pdu, msg, strlen(msg));
+
+        if (type == CORPUS_FRAME)
+        {
+            wb = encode_frame(&pdu, i == 0);
+        }
+        else
+        {
+            wb = encode_pdu(&pdu, type == CORPUS_PLAIN || i == 0);
+        }
+
+        if (wb == NULL || (corpus = realloc(corpus, *len + wb->len + 1)) == NULL)
+        {
+            ui_fatal("Recording of corpus failed!");
+        }
+
+        memcpy(corpus + *len, wb->data, wb->len);
+        *len += wb->len;
+        release_wire_buf(wb);
+        free_pdu(&pdu);
+    }
+
+    return corpus;
+}
+
+
+/**
+ *  Parses a corpus PARSE_ROUNDS times and prints the cost per PDU.
+ *  @param name   Name of the corpus
+ *  @param corpus Recorded PDUs
+ *  @param len    Length of the corpus
+ *  @return 0 on success, -1 if the corpus could not be parsed
+ */
+int
+parse_corpus(char* name, char* corpus, int len)
+{
+    pdu_reader_t rd;       // reader parsing the corpus
+    dchat_pdu_t pdu;       // parsed PDU
+    struct timespec start; // start of a round
+    double nsec = 0;       // time spent in next_pdu()
+    int pdus = 0;          // PDUs parsed
+    int ret;
+
+    // the reader parses in place and needs room for a terminating \0
+    if ((rd.buf = malloc(len + 1)) == NULL)
+    {
+        ui_fatal("Memory allocation for receive buffer failed!");
+    }
+
+    for (int r = 0; r < PARSE_ROUNDS; r++)
+    {
+        char* buf = rd.buf;
+
+        memset(&rd, 0, sizeof(rd));
+        rd.buf = buf;
+        rd.size = rd.len = len;
+        memcpy(rd.buf, corpus, len);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        while ((ret = next_pdu(&rd, &pdu)) > 0)
+        {
+            free_pdu(&pdu);
+            pdus++;
+        }
+
+        nsec += elapsed_nsec(&start);
+
+        if (ret == -1)
+        {
+            free(rd.buf);
+            return -1;
+        }
+    }
+
+    free(rd.buf);
+    printf("%-8s %8d %10d %10.1f %10.1f\n", name, pdus / PARSE_ROUNDS, len,
+           nsec / pdus, (double) len * PARSE_ROUNDS / nsec * 1e3);
+    return 0;
+}
+
+
+int
+main()
+{
+    char* name[] = { "plain", "session", "frame" };
+    char* corpus;
+    int len;
+
+    printf("%-8s %8s %10s %10s %10s\n", "corpus", "pdus", "bytes", "ns/pdu", "MB/s");
+
+    for (int type = CORPUS_PLAIN; type <= CORPUS_FRAME; type++)
+    {
+        corpus = record_corpus(type, &len);
+
+        if (parse_corpus(name[type], corpus, len) == -1)
+        {
+            ui_fatal("Parsing of corpus '%s' failed!", name[type]);
+        }
+
+        free(corpus);
+    }
+
+    return EXIT_SUCCESS;
+}
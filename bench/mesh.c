@@ -0,0 +1,143 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file mesh.c
+ *  This file sets up the workers of a daemon and fills their contactlists
+ *  with identified contacts, so that the contact functions can be run on
+ *  meshes of any size. The sockets of the contacts are eventfds, since
+ *  nothing is written to them.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include "dchat_h/types.h"
+#include "dchat_h/contact.h"
+#include "dchat_h/consoleui.h"
+#include "bench.h"
+
+static int _mesh_size; //!< contacts added so far
+
+
+/**
+ *  Sets up the global config and the given amount of workers. The limit
+ *  of open files is raised as far as possible.
+ *  @param workers Amount of workers
+ *  @return maximum amount of contacts
+ */
+int
+init_mesh(int workers)
+{
+    struct rlimit rl;
+
+    if ((_cnf = calloc(1, sizeof(*_cnf))) == NULL ||
+        (_cnf->wk = calloc(workers, sizeof(worker_t))) == NULL)
+    {
+        ui_fatal("Memory allocation for config failed!");
+    }
+
+    _cnf->workers = workers;
+    _cnf->epoch = 1;
+    _cnf->qhigh = QUEUE_HIGH;
+    _cnf->qlow = QUEUE_LOW;
+    strcpy(_cnf->me.onion_id, "aaaaaaaaaaaaaaaa.onion");
+    _cnf->me.lport = 7777;
+    strcpy(_cnf->me.name, "me");
+
+    for (int w = 0; w < workers; w++)
+    {
+        if ((_cnf->wk[w].epfd = epoll_create1(0)) == -1)
+        {
+            ui_fatal("Creation of epoll instance failed!");
+        }
+    }
+
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    return rl.rlim_cur - 64;
+}
+
+
+/**
+ *  Builds the onion address of the i-th contact of the mesh.
+ *  @param i        Index of contact
+ *  @param onion_id Receives the onion address
+ */
+void
+mesh_onion(int i, char* onion_id)
+{
+    const char* base32 = "abcdefghijklmnopqrstuvwxyz234567";
+
+    // contacts start with 'b', so that they differ from us
+    onion_id[0] = 'b';
+
+    for (int c = 1; c < ONION_ADDRLEN - 6; c++, i /= 32)
+    {
+        onion_id[c] = base32[i % 32];
+    }
+
+    strcpy(onion_id + ONION_ADDRLEN - 6, ".onion");
+}
+
+
+/**
+ *  Adds identified contacts to the workers round robin until the mesh
+ *  has the given size.
+ *  @param size Amount of contacts
+ */
+void
+grow_mesh(int size)
+{
+    worker_t* wk;
+    contact_t* contact;
+    int fd, n;
+
+    for (; _mesh_size < size; _mesh_size++)
+    {
+        wk = &_cnf->wk[_mesh_size % _cnf->workers];
+
+        if ((fd = eventfd(0, EFD_NONBLOCK)) == -1)
+        {
+            ui_fatal("Creation of socket of contact %d failed!", _mesh_size);
+        }
+
+        if ((n = add_contact(wk, fd)) == -1)
+        {
+            ui_fatal("Adding of contact %d failed!", _mesh_size);
+        }
+
+        contact = CONTACT(wk, n);
+        mesh_onion(_mesh_size, contact->onion_id);
+        contact->lport = 7777;
+        snprintf(contact->name, sizeof(contact->name), "peer%d", _mesh_size);
+        index_contact(wk, n);
+        wk->dir_dirty = 1;
+    }
+}
@@ -0,0 +1,175 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** @file stubs.c
+ *  This file replaces the user interface and the threads of the daemon,
+ *  so that the core modules can be benchmarked on their own.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dchat_h/types.h"
+#include "dchat_h/consoleui.h"
+#include "dchat_h/dchat.h"
+#include "bench.h"
+
+
+dchat_conf_t* _cnf;             //!< configuration set up by the benchmark
+unsigned long bench_requests;   //!< connection requests of the contacts
+
+
+/**
+ *  Prints warnings and errors of the core modules to stderr, everything
+ *  else is dropped since it would be measured otherwise.
+ *  @param lf  Log level
+ *  @param fmt Format string
+ *  @return 0
+ */
+int
+ui_log(int lf, const char* fmt, ...)
+{
+    va_list ap;
+
+    if (lf <= LOG_WARN)
+    {
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        fputc('\n', stderr);
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Same as ui_log() with the description of errno appended.
+ *  @param lf  Log level
+ *  @param fmt Format string
+ *  @return 0
+ */
+int
+ui_log_errno(int lf, const char* fmt, ...)
+{
+    va_list ap;
+    int err = errno;
+
+    if (lf <= LOG_WARN)
+    {
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        fprintf(stderr, " (%s)\n", strerror(err));
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Prints the message to stderr and terminates the benchmark.
+ *  @param fmt Format string
+ */
+void
+ui_fatal(char* fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(EXIT_FAILURE);
+}
+
+
+/**
+ *  Discards streamed "application/octet" content.
+ *  @return 0
+ */
+int
+consume_octet(dchat_pdu_t* pdu, char* chunk, int len)
+{
+    (void) pdu;
+    (void) chunk;
+    (void) len;
+    return 0;
+}
+
+
+/**
+ *  Drops messages to other workers, the benchmarks run in one thread.
+ */
+void
+post_msgs(worker_t* wk, worker_msg_t* msg, int cnt)
+{
+    (void) wk;
+    (void) msg;
+    (void) cnt;
+}
+
+
+/**
+ *  Drops a message to another worker.
+ *  @see post_msgs()
+ */
+void
+post_msg(worker_t* wk, worker_msg_t* msg)
+{
+    post_msgs(wk, msg, 1);
+}
+
+
+/**
+ *  Counts connection requests instead of passing them to a connector.
+ *  @return 0
+ */
+int
+request_connection(ring_t* rq, char* onion_id, uint16_t port)
+{
+    (void) rq;
+    (void) onion_id;
+    (void) port;
+    bench_requests++;
+    return 0;
+}
+
+
+/**
+ *  Returns the nanoseconds elapsed since the given point of time.
+ *  @param start Point of time taken with CLOCK_MONOTONIC
+ *  @return elapsed nanoseconds
+ */
+double
+elapsed_nsec(struct timespec* start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
@@ -30,6 +30,8 @@
 
 #include "dchat_h/cmdinterpreter.h"
 #include "dchat_h/types.h"
+#include "dchat_h/dchat.h"
+#include "dchat_h/contact.h"
 #include "dchat_h/util.h"
 #include "dchat_h/consoleui.h"
 
@@ -105,7 +107,8 @@ init_cmds(cmds_t* cmds)
     {
         COMMAND(CMD_ID_HLP, CMD_NAME_HLP, CMD_ARG_HLP, hlp_exec),
         COMMAND(CMD_ID_CON, CMD_NAME_CON, CMD_ARG_CON, con_exec),
-        COMMAND(CMD_ID_LST, CMD_NAME_LST, CMD_ARG_LST, lst_exec)
+        COMMAND(CMD_ID_LST, CMD_NAME_LST, CMD_ARG_LST, lst_exec),
+        COMMAND(CMD_ID_STA, CMD_NAME_STA, CMD_ARG_STA, sta_exec)
     };
     temp_size = sizeof(temp) / sizeof(temp[0]);
 
@@ -185,15 +188,11 @@ con_exec(char* arg)
         return 1;
     }
 
-    // write onion address to connector pipe
-    if (write(_cnf->connect_fd[1], address, ONION_ADDRLEN) == -1)
+    // pass onion address and port to connector
+    if (request_connection(&_cnf->connect_rq, address, port) == -1)
     {
-        return -1;
-    }
-
-    if (write(_cnf->connect_fd[1], &port, sizeof(uint16_t)) == -1)
-    {
-        return -1;
+        ui_log(LOG_WARN, "Connector is busy, try again later!");
+        return 1;
     }
 
     return 0;
@@ -207,27 +206,66 @@ con_exec(char* arg)
 int
 lst_exec(char* arg)
 {
-    int i;
+    directory_t* dir; // published contacts of a worker
+    int found = 0;    // amount of contacts listed
+    int i, w;
+
+    // listing never waits for the workers
+    enter_directory(NULL);
+
+    for (w = 0; w < _cnf->workers; w++)
+    {
+        dir = get_directory(&_cnf->wk[w]);
+
+        for (i = 0; dir != NULL && i < dir->cnt; i++)
+        {
+            ui_log(LOG_NOTICE, "");
+            // print all available information about the connection
+            ui_log(LOG_NOTICE, "Contact................%s", dir->entry[i].name);
+            ui_log(LOG_NOTICE, "Onion-ID...............%s", dir->entry[i].onion_id);
+            ui_log(LOG_NOTICE, "Hidden-Port............%hu", dir->entry[i].lport);
+            found++;
+        }
+    }
+
+    leave_directory(NULL);
 
     // are there no contacts in the list a message will be printed
-    if (!_cnf->cl.used_contacts)
+    if (!found)
     {
         ui_log(LOG_NOTICE, "No contacts found in the contactlist");
     }
-    else
+
+    return 0;
+}
+
+
+/**
+ * Prints runtime statistics of this client.
+ * @return 0 on success, 1 on syntax error, -1 otherwise
+ */
+int
+sta_exec(char* arg)
+{
+    dchat_stats_t* st = &_cnf->st;
+
+    ui_log(LOG_NOTICE, "PDUs received..........%lu", st->rx_pdus);
+    ui_log(LOG_NOTICE, "Bytes received.........%lu", st->rx_bytes);
+    ui_log(LOG_NOTICE, "Read syscalls..........%lu", st->rx_syscalls);
+
+    if (st->rx_pdus)
+    {
+        ui_log(LOG_NOTICE, "Syscalls per PDU.......%.2f",
+               (double) st->rx_syscalls / st->rx_pdus);
+    }
+
+    ui_log(LOG_NOTICE, "Handshakes granted.....%lu", st->socks_ok);
+    ui_log(LOG_NOTICE, "Handshakes failed......%lu", st->socks_failed);
+
+    if (st->socks_ok)
     {
-        for (i = 0; i < _cnf->cl.cl_size; i++)
-        {
-            // check if entry is a valid connection
-            if (_cnf->cl.contact[i].fd)
-            {
-                ui_log(LOG_NOTICE, "");
-                // print all available information about the connection
-                ui_log(LOG_NOTICE, "Contact................%s", _cnf->cl.contact[i].name);
-                ui_log(LOG_NOTICE, "Onion-ID...............%s", _cnf->cl.contact[i].onion_id);
-                ui_log(LOG_NOTICE, "Hidden-Port............%hu", _cnf->cl.contact[i].lport);
-            }
-        }
+        ui_log(LOG_NOTICE, "Handshake avg (ms).....%lu", st->socks_msec / st->socks_ok);
+        ui_log(LOG_NOTICE, "Handshake max (ms).....%lu", st->socks_max);
     }
 
     return 0;
@@ -2,9 +2,13 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -13,6 +17,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <pthread.h>
+#include <stdint.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -20,29 +25,37 @@
 
 #include "dchat_h/consoleui.h"
 #include "dchat_h/decoder.h"
+#include "dchat_h/network.h"
+#include "dchat_h/dchat.h"
 
 // log level
 static int level_ = LOG_DEBUG;
 static const char* flty_[8] = {"emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"};
 
-static int _recival = 5;
-static int _reconnect = 1;
-static pthread_mutex_t _lock;
-static pthread_mutex_t _lock_wake;
-static pthread_cond_t _cond;
-static pthread_cond_t _cond_wake;
+static ipc_t _ipc_inp; // subscribers of chat messages
+static ipc_t _ipc_out; // clients passing user input
+static ipc_t _ipc_log; // subscribers of log messages
 
-static ipc_t _ipc_inp;
-static ipc_t _ipc_out;
-static ipc_t _ipc_log;
+static pthread_t _th_out;
 
-static pthread_t _th_acpt_inp;
-static pthread_t _th_acpt_out;
-static pthread_t _th_acpt_log;
-static pthread_t _th_rec;
+// lines waiting for the output thread, newest first
+static ui_line_t* _ui_head;
+static int _ui_pending;
+static unsigned long _ui_dropped;
+static int _ui_efd = -1;
+
+// subscribers, only accessed by the output thread
+static ui_client_t _sub[UI_MAX_CLIENTS];
+// lines spooled while nobody subscribed to them, per type
+static ui_client_t _spool[2];
+// input clients, only accessed by the thread reading user input
+static line_reader_t _inp[UI_MAX_CLIENTS];
+static int _inp_epfd = -1;
+static int _inp_next;
 
 /**
- * Initializes input, output and log filedescriptor.
+ * Initializes input, output and log sockets and starts the output thread.
+ * Frontends may attach to and detach from the sockets at any time.
  * @return 0 on success, -1 in case of error
  */
 int
@@ -52,65 +65,67 @@ init_ui()
     _ipc_out.path = OUT_SOCK_PATH;
     _ipc_log.path = LOG_SOCK_PATH;
 
-    // mutex for reconnect
-    if (pthread_mutex_init(&_lock, NULL) != 0)
+    for (int i = 0; i < UI_MAX_CLIENTS; i++)
     {
-        return -1;
+        _sub[i].fd = -1;
+        _inp[i].fd = -1;
     }
 
-    // mutex for reconnect_wake
-    if (pthread_mutex_init(&_lock_wake, NULL) != 0)
+    for (int i = 0; i < 2; i++)
     {
-        return -1;
+        _spool[i].fd = -1;
+        _spool[i].type = i;
+
+        if ((_spool[i].q = malloc(UI_QUEUE_MAX * sizeof(*_spool[i].q))) == NULL)
+        {
+            return -1;
+        }
     }
 
-    // reconnect condition
-    if (pthread_cond_init(&_cond, NULL) != 0)
+    signal(SIGPIPE, SIG_IGN);
+
+    if (unix_listen(&_ipc_inp) == -1 || unix_listen(&_ipc_out) == -1 ||
+        unix_listen(&_ipc_log) == -1)
     {
         return -1;
     }
 
-    // reconnect wake condition
-    if (pthread_cond_init(&_cond_wake, NULL) != 0)
+    // input clients are watched by the thread reading user input
+    if ((_inp_epfd = epoll_create1(0)) == -1 ||
+        watch_fd(_inp_epfd, _ipc_out.fd, &_ipc_out) == -1)
     {
+        local_log_errno(LOG_ERR, "Registration at epoll instance failed!");
         return -1;
     }
 
-    signal(SIGPIPE, SIG_IGN);
-    pthread_create(&_th_rec, NULL, (void*) th_ipc_reconnector, NULL);
-    return 0;
-}
-
-/**
- * Closes all open sockets
- */
-void
-free_unix_socks()
-{
-    if (_cnf->in_fd > 2)
+    // doorbell of output thread
+    if ((_ui_efd = eventfd(0, EFD_NONBLOCK)) == -1)
     {
-        close(_cnf->in_fd);
-        _cnf->in_fd = -1;
+        return -1;
     }
 
-    if (_cnf->out_fd > 2)
-    {
-        close(_cnf->out_fd);
-        _cnf->out_fd = -1;
-    }
+    // lines pushed before there was a doorbell did not ring it
+    ring_notify(_ui_efd);
 
-    if (_cnf->log_fd > 2)
+    if (pthread_create(&_th_out, NULL, (void*) th_ui_output, NULL))
     {
-        close(_cnf->log_fd);
-        _cnf->log_fd = -1;
+        return -1;
     }
+
+    return 0;
 }
 
 
+/**
+ * Creates a listening unix socket for the given ipc path.
+ * The socket is non-blocking and stays open, so that frontends can
+ * connect at any time.
+ * @param ipc Path of socket, receives the listening socket
+ * @return listening socket, -1 in case of error
+ */
 int
-unix_accept(ipc_t* ipc)
+unix_listen(ipc_t* ipc)
 {
-    int fd;
     struct sockaddr_un sock_addr;
     memset(&sock_addr, 0, sizeof(sock_addr));
 
@@ -121,7 +136,7 @@ unix_accept(ipc_t* ipc)
         return -1;
     }
 
-    if ((ipc->fd = socket(PF_LOCAL, SOCK_STREAM, 0)) == -1)
+    if ((ipc->fd = socket(PF_LOCAL, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1)
     {
         local_log_errno(LOG_ERR, "Creation of unix socket failed!");
         return -1;
@@ -136,112 +151,522 @@ unix_accept(ipc_t* ipc)
         return -1;
     }
 
-    if (listen(ipc->fd, 1) == -1)
+    if (listen(ipc->fd, UI_BACKLOG) == -1)
     {
         local_log_errno(LOG_ERR, "Listening on unix socket failed!");
         return -1;
     }
 
-    if ((fd = accept(ipc->fd, 0, 0)) == -1)
+    return ipc->fd;
+}
+
+
+/**
+ * Passes a line to the output thread.
+ * Lines are pushed lock-free onto a stack which the output thread takes
+ * at once. If UI_PENDING_MAX lines are pending already, the output thread
+ * does not keep up and the line is dropped, which is summarized by the
+ * output thread later on.
+ * @param ln    Line to write
+ * @param force Pass line even if too many lines are pending
+ * @return 0 on success, -1 if the line has been dropped
+ */
+int
+push_ui_line(ui_line_t* ln, int force)
+{
+    ui_line_t* old;
+
+    if (__atomic_add_fetch(&_ui_pending, 1, __ATOMIC_RELAXED) > UI_PENDING_MAX && !force)
     {
-        local_log_errno(LOG_ERR, "Accepting new connection on unix socket failed!");
+        __atomic_sub_fetch(&_ui_pending, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&_ui_dropped, 1, __ATOMIC_RELAXED);
+        free(ln);
         return -1;
     }
 
-    // close accept fd
-    close(ipc->fd);
-    // set ptr->fd from accept fd to actual filedescriptor
-    ipc->fd = fd;
-    return fd;
+    // reference of the output thread until the line has been fanned out
+    ln->refs = 1;
+    old = __atomic_load_n(&_ui_head, __ATOMIC_RELAXED);
+
+    do
+    {
+        ln->next = old;
+    }
+    while (!__atomic_compare_exchange_n(&_ui_head, &old, ln, 1, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED));
+
+    // only the first pending line has to wake up the output thread
+    if (old == NULL && _ui_efd != -1)
+    {
+        ring_notify(_ui_efd);
+    }
+
+    return 0;
 }
 
 
-void*
-th_ipc_accept(void* ptr)
+/**
+ * Formats a new line for the user interface.
+ * @param type UI_OUT or UI_LOG
+ * @param fmt  Format string
+ * @param ...  Arguments
+ * @return formatted line
+ */
+ui_line_t*
+new_ui_line(int type, const char* fmt, ...)
 {
-    ipc_t* ipc = (ipc_t*)ptr;
-    int ret;
-    ret = unix_accept(ipc);
+    ui_line_t* ln;
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
 
-    // filedescriptor mus be higher than 2;
-    if (ipc->fd <= 2)
+    if ((ln = malloc(sizeof(*ln) + len + 1)) == NULL)
     {
-        ipc->fd = -1;
+        ui_fatal("Memory allocation for ui line failed!");
     }
 
-    pthread_exit(NULL);
+    memset(ln, 0, sizeof(*ln));
+    ln->type = type;
+    va_start(ap, fmt);
+    ln->len = vsnprintf(ln->buf, len + 1, fmt, ap);
+    va_end(ap);
+    return ln;
+}
+
+
+/**
+ * Takes all lines pending for the output thread.
+ * @return oldest pending line, lines are linked in the order they
+ *         have been passed
+ */
+ui_line_t*
+take_ui_lines()
+{
+    ui_line_t* ln = __atomic_exchange_n(&_ui_head, NULL, __ATOMIC_ACQUIRE);
+    ui_line_t* prev = NULL;
+    ui_line_t* next;
+    int cnt = 0;
+
+    // stack has been pushed newest first
+    for (; ln != NULL; ln = next, cnt++)
+    {
+        next = ln->next;
+        ln->next = prev;
+        prev = ln;
+    }
+
+    __atomic_sub_fetch(&_ui_pending, cnt, __ATOMIC_RELAXED);
+    return prev;
+}
+
+
+/**
+ * Appends a line to the queue of a subscriber.
+ * @param cl Subscriber
+ * @param ln Line to append
+ * @return 0 on success, -1 if the queue is full and the line is dropped
+ */
+int
+enqueue_ui_line(ui_client_t* cl, ui_line_t* ln)
+{
+    if (cl->cnt == UI_QUEUE_MAX)
+    {
+        cl->dropped++;
+        return -1;
+    }
+
+    cl->q[(cl->head + cl->cnt) % UI_QUEUE_MAX] = ln;
+    cl->cnt++;
+    ln->refs++;
+    return 0;
 }
 
 
+/**
+ * Releases a line, which is freed as soon as no subscriber refers to it
+ * anymore.
+ * @param ln Line to release
+ */
 void
-ipc_connect()
+release_ui_line(ui_line_t* ln)
 {
-    while (1)
+    if (--ln->refs == 0)
+    {
+        free(ln);
+    }
+}
+
+
+/**
+ * Spools a line nobody subscribed to.
+ * The spool keeps the latest UI_SPOOL_MAX lines of a type, older ones
+ * are dropped.
+ * @param ln Line to spool
+ */
+void
+spool_ui_line(ui_line_t* ln)
+{
+    ui_client_t* sp = &_spool[ln->type];
+
+    if (sp->cnt == UI_SPOOL_MAX)
+    {
+        release_ui_line(sp->q[sp->head]);
+        sp->head = (sp->head + 1) % UI_QUEUE_MAX;
+        sp->cnt--;
+        sp->dropped++;
+    }
+
+    enqueue_ui_line(sp, ln);
+}
+
+
+/**
+ * Moves the spooled lines of the subscribers type into its queue.
+ * @param cl Subscriber which has just been attached
+ */
+void
+replay_ui_spool(ui_client_t* cl)
+{
+    ui_client_t* sp = &_spool[cl->type];
+
+    for (; sp->cnt; sp->cnt--)
     {
-        free_unix_socks();
-        local_log(LOG_NOTICE, "INIT LISTEN SOCKS");
-        pthread_create(&_th_acpt_inp, NULL, (void*) th_ipc_accept, &_ipc_inp);
-        pthread_create(&_th_acpt_out, NULL, (void*) th_ipc_accept, &_ipc_out);
-        pthread_create(&_th_acpt_log, NULL, (void*) th_ipc_accept, &_ipc_log);
-        pthread_join(_th_acpt_inp, NULL);
-        pthread_join(_th_acpt_out, NULL);
-        pthread_join(_th_acpt_log, NULL);
-        _cnf->in_fd = _ipc_out.fd;
-        _cnf->out_fd = _ipc_inp.fd;
-        _cnf->log_fd = _ipc_log.fd;
-
-        if (_cnf->in_fd != -1 && _cnf->out_fd != -1 && _cnf->log_fd != -1)
+        enqueue_ui_line(cl, sp->q[sp->head]);
+        release_ui_line(sp->q[sp->head]);
+        sp->head = (sp->head + 1) % UI_QUEUE_MAX;
+    }
+
+    if (sp->dropped)
+    {
+        ui_log_summary(LOG_WARN, "%lu lines dropped while no user interface was attached!",
+                       sp->dropped);
+        sp->dropped = 0;
+    }
+}
+
+
+/**
+ * Passes the given lines to every subscriber of their type. Lines
+ * nobody subscribed to are spooled until a subscriber attaches.
+ * @param ln Oldest line
+ */
+void
+fan_out_ui_lines(ui_line_t* ln)
+{
+    ui_line_t* next;
+    int found;
+
+    for (; ln != NULL; ln = next)
+    {
+        next = ln->next;
+        found = 0;
+
+        for (int i = 0; i < UI_MAX_CLIENTS; i++)
         {
-            local_log(LOG_NOTICE, "CONNECTIONS ESTABLISHED");
-            break;
+            if (_sub[i].fd != -1 && _sub[i].type == ln->type)
+            {
+                enqueue_ui_line(&_sub[i], ln);
+                found = 1;
+            }
+        }
+
+        if (!found)
+        {
+            spool_ui_line(ln);
+        }
+
+        release_ui_line(ln);
+    }
+}
+
+
+/**
+ * Accepts all pending connections of subscribers.
+ * Chat subscribers are greeted with the nickname of this client. The
+ * first subscriber of a type receives the lines spooled while nobody
+ * was subscribed to them.
+ * @param epfd epoll(7) instance of output thread
+ * @param ipc  Listening socket
+ * @param type UI_OUT or UI_LOG
+ */
+void
+accept_ui_clients(int epfd, ipc_t* ipc, int type)
+{
+    struct epoll_event ev;
+    ui_client_t* cl;
+    int fd;
+    int i;
+
+    while ((fd = accept4(ipc->fd, NULL, NULL, SOCK_NONBLOCK)) != -1)
+    {
+        for (i = 0; i < UI_MAX_CLIENTS && _sub[i].fd != -1; i++);
+
+        if (i == UI_MAX_CLIENTS)
+        {
+            local_log(LOG_WARN, "TOO MANY UI CLIENTS");
+            close(fd);
+            continue;
         }
 
-        local_log(LOG_WARN, "CONNECTIONS FAILED");
-        local_log(LOG_NOTICE, "RE-INIT LISTEN SOCKS");
-        sleep(_recival);
+        cl = &_sub[i];
+        memset(cl, 0, sizeof(*cl));
+        cl->type = type;
+
+        if ((cl->q = malloc(UI_QUEUE_MAX * sizeof(*cl->q))) == NULL)
+        {
+            ui_fatal("Memory allocation for ui client failed!");
+        }
+
+        // frontends do not send anything, EPOLLIN reports their EOF
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = cl;
+
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        {
+            local_log_errno(LOG_ERR, "Registration at epoll instance failed!");
+            free(cl->q);
+            close(fd);
+            cl->fd = -1;
+            continue;
+        }
+
+        cl->fd = fd;
+        local_log(LOG_NOTICE, "UI CLIENT CONNECTED");
+
+        if (type == UI_OUT)
+        {
+            enqueue_ui_line(cl, new_ui_line(UI_OUT, "%s;\n", _cnf->me.name));
+        }
+
+        replay_ui_spool(cl);
     }
 }
 
 
+/**
+ * Closes the connection to a subscriber and releases its pending lines.
+ * @param cl Subscriber
+ */
 void
-signal_reconnect()
+close_ui_client(ui_client_t* cl)
+{
+    for (; cl->cnt; cl->cnt--)
+    {
+        release_ui_line(cl->q[cl->head]);
+        cl->head = (cl->head + 1) % UI_QUEUE_MAX;
+    }
+
+    free(cl->q);
+    close(cl->fd);
+    cl->fd = -1;
+    local_log(LOG_NOTICE, "UI CLIENT DISCONNECTED");
+}
+
+
+/**
+ * Writes the pending lines of a subscriber.
+ * Up to FLUSH_IOV lines are written by a single writev(2). If the
+ * subscriber does not take more data, the rest is written as soon as it
+ * becomes writable again. Lines dropped in the meantime are summarized
+ * by a warning once the queue has drained.
+ * @param epfd epoll(7) instance of output thread
+ * @param cl   Subscriber
+ * @return 0 on success, -1 in case of error
+ */
+int
+flush_ui_client(int epfd, ui_client_t* cl)
 {
-    local_log(LOG_NOTICE, "WAITING FOR RECONNECTION");
-    _reconnect = 1;
-    pthread_cond_signal(&_cond);
+    struct iovec iov[FLUSH_IOV]; // pending lines
+    struct epoll_event ev;       // events of subscriber
+    ui_line_t* ln;
+    ssize_t ret;
+    int cnt;
+    int i;
+
+    while (cl->cnt)
+    {
+        cnt = cl->cnt < FLUSH_IOV ? cl->cnt : FLUSH_IOV;
+
+        for (i = 0; i < cnt; i++)
+        {
+            ln = cl->q[(cl->head + i) % UI_QUEUE_MAX];
+            iov[i].iov_base = ln->buf + (i ? 0 : cl->off);
+            iov[i].iov_len = ln->len - (i ? 0 : cl->off);
+        }
+
+        if ((ret = writev(cl->fd, iov, cnt)) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                return -1;
+            }
+
+            break;
+        }
+
+        // release lines written completely
+        for (ret += cl->off; cl->cnt && ret >= cl->q[cl->head]->len; cl->cnt--)
+        {
+            ret -= cl->q[cl->head]->len;
+            release_ui_line(cl->q[cl->head]);
+            cl->head = (cl->head + 1) % UI_QUEUE_MAX;
+        }
+
+        cl->off = ret;
+    }
+
+    // wait for writability only while lines are pending
+    if (cl->armed != (cl->cnt > 0))
+    {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = cl->cnt ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        ev.data.ptr = cl;
+
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, cl->fd, &ev) == -1)
+        {
+            return -1;
+        }
+
+        cl->armed = cl->cnt > 0;
+    }
+
+    if (!cl->cnt && cl->dropped)
+    {
+        ui_log_summary(LOG_WARN, "%lu lines dropped, user interface is too slow!",
+                       cl->dropped);
+        cl->dropped = 0;
+    }
+
+    return 0;
 }
 
 
+/**
+ * Thread function which writes the lines passed by ui_write() and
+ * ui_log() to all subscribers.
+ * Waits with epoll(7) for lines, new subscribers and subscribers which
+ * can take more data. Every subscriber has its own queue of lines, so a
+ * slow subscriber neither stalls the threads producing the lines nor the
+ * other subscribers. A subscriber which falls behind by UI_QUEUE_MAX
+ * lines loses further lines until it has caught up.
+ */
 void*
-th_ipc_reconnector(void* ptr)
+th_ui_output(void* ptr)
 {
+    struct epoll_event ev[MAX_EVENTS]; // ready file descriptors
+    ui_client_t* cl;
+    unsigned long dropped;
+    char buf[64];       // data sent by subscribers
+    int epfd;           // epoll(7) instance of output thread
+    int nfds;           // number of ready file descriptors
+    int ret;
+    int i;
+
+    if ((epfd = epoll_create1(0)) == -1 || watch_fd(epfd, _ui_efd, &_ui_efd) == -1 ||
+        watch_fd(epfd, _ipc_inp.fd, &_ipc_inp) == -1 ||
+        watch_fd(epfd, _ipc_log.fd, &_ipc_log) == -1)
+    {
+        local_log_errno(LOG_ERR, "Registration at epoll instance failed!");
+        pthread_exit(NULL);
+    }
+
     while (1)
     {
-        pthread_mutex_lock(&_lock);
+        if ((nfds = epoll_wait(epfd, ev, MAX_EVENTS, -1)) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
 
-        while (!_reconnect)
+            local_log_errno(LOG_ERR, "epoll_wait() failed!");
+            break;
+        }
+
+        for (i = 0; i < nfds; i++)
         {
-            pthread_cond_wait(&_cond, &_lock);
+            if (ev[i].data.ptr == &_ui_efd)
+            {
+                ring_drain(_ui_efd);
+                fan_out_ui_lines(take_ui_lines());
+            }
+            else if (ev[i].data.ptr == &_ipc_inp)
+            {
+                accept_ui_clients(epfd, &_ipc_inp, UI_OUT);
+            }
+            else if (ev[i].data.ptr == &_ipc_log)
+            {
+                accept_ui_clients(epfd, &_ipc_log, UI_LOG);
+            }
+            else
+            {
+                cl = ev[i].data.ptr;
+
+                // subscriber has been closed meanwhile
+                if (cl->fd == -1)
+                {
+                    continue;
+                }
+
+                // discard data, EOF or error closes the subscriber
+                if ((ret = read(cl->fd, buf, sizeof(buf))) == 0 ||
+                    (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                {
+                    close_ui_client(cl);
+                }
+            }
+        }
+
+        for (i = 0; i < UI_MAX_CLIENTS; i++)
+        {
+            if (_sub[i].fd != -1 && _sub[i].cnt && flush_ui_client(epfd, &_sub[i]) == -1)
+            {
+                close_ui_client(&_sub[i]);
+            }
         }
 
-        pthread_mutex_lock(&_lock_wake);
-        ipc_connect();
-        _reconnect = 0;
-        pthread_cond_broadcast(&_cond_wake);
-        pthread_mutex_unlock(&_lock_wake);
-        pthread_mutex_unlock(&_lock);
-        ui_write(_cnf->me.name, "");
+        // lines dropped before they reached the output thread
+        if ((dropped = __atomic_exchange_n(&_ui_dropped, 0, __ATOMIC_RELAXED)) > 0)
+        {
+            ui_log_summary(LOG_WARN, "%lu lines dropped, user interface is too slow!",
+                           dropped);
+        }
     }
 
-    free_unix_socks();
-    pthread_mutex_destroy(&_lock);
-    pthread_cond_destroy(&_cond);
+    close(epfd);
+    pthread_exit(NULL);
 }
 
 
+/**
+ * Passes a log message to the output thread, even if too many lines are
+ * pending.
+ * @param lf Log priority
+ * @param fmt Format string
+ * @param ... arguments
+ */
+void
+ui_log_summary(int lf, const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vui_log(lf, fmt, ap, 0, 1);
+    va_end(ap);
+}
+
 
 /**
  * Write recived message to out file descriptor.
+ * The message is written by the output thread.
  * @nickname Nickname of the client from whom we received the message
  * @msg Text message to print
  * @return 0 on success, -1 in case of error
@@ -249,25 +674,38 @@ th_ipc_reconnector(void* ptr)
 int
 ui_write(char* nickname, char* msg)
 {
-    int ret;
-    pthread_mutex_lock(&_lock);
+    return push_ui_line(new_ui_line(UI_OUT, "%s;%s\n", nickname, msg), 0);
+}
 
-    if (dprintf(_cnf->out_fd, "%s;%s\n", nickname, msg) < 0)
-    {
-        pthread_mutex_lock(&_lock_wake);
-        signal_reconnect();
-        pthread_mutex_unlock(&_lock);
-        pthread_cond_wait(&_cond_wake, &_lock_wake);
-        pthread_mutex_unlock(&_lock_wake);
-        ret = -1;
-    }
-    else
+/**
+*  Formats a log message.
+*  @param buf Buffer receiving the message
+*  @param size Size of buffer
+*  @param lf Logging priority (equal to syslog)
+*  @param fmt Format string
+*  @param ap Variable parameter list
+*  @param with_errno Flag if errno should be printed too
+*  @return length of the message, which is truncated if it is greater
+*          or equal than `size`
+*/
+int
+format_log(char* buf, int size, int lf, const char* fmt, va_list ap, int with_errno)
+{
+    int err = errno;
+    int len;
+
+#define REST(len) ((len) < size ? buf + (len) : NULL), ((len) < size ? size - (len) : 0)
+    len = snprintf(REST(0), "%s;", flty_[LOG_PRI(lf)]);
+    len += vsnprintf(REST(len), fmt, ap);
+
+    if (with_errno)
     {
-        pthread_mutex_unlock(&_lock);
-        ret = 0;
+        len += snprintf(REST(len), " (%s)", strerror(err));
     }
 
-    return ret;
+    len += snprintf(REST(len), "\n");
+#undef REST
+    return len;
 }
 
 /**
@@ -284,6 +722,7 @@ vlog_msgf(int fd, int lf, const char* fmt, va_list ap, int with_errno)
 {
     int level = LOG_PRI(lf);
     char buf[1024];
+    int len;
 
     if (level_ < level)
     {
@@ -292,25 +731,14 @@ vlog_msgf(int fd, int lf, const char* fmt, va_list ap, int with_errno)
 
     if (fd > -1)
     {
-        if (dprintf(fd, "%s;", flty_[level]) < 0)
+        // written at once
+        if ((len = format_log(buf, sizeof(buf), lf, fmt, ap, with_errno)) >= (int) sizeof(buf))
         {
-            return -1;
+            len = sizeof(buf) - 1;
+            buf[len - 1] = '\n';
         }
 
-        if (vdprintf(fd, fmt, ap) < 0)
-        {
-            return -1;
-        }
-
-        if (with_errno)
-        {
-            if (dprintf(fd, " (%s)", strerror(errno)) < 0)
-            {
-                return -1;
-            }
-        }
-
-        if (dprintf(fd, "\n") < 0)
+        if (write(fd, buf, len) < 0)
         {
             return -1;
         }
@@ -330,37 +758,59 @@ vlog_msgf(int fd, int lf, const char* fmt, va_list ap, int with_errno)
 
 
 /**
- *  Log a message to log filedescriptor.
+ *  Passes a log message to the output thread.
  *  @param lf Log priority
  *  @param fmt Format string
- *  @param ... arguments
+ *  @param ap Variable parameter list
+ *  @param with_errno Flag if errno should be printed too
+ *  @param force Pass message even if too many lines are pending
  *  @return 0 on sucess, -1 in case of error
  */
 int
-ui_log(int lf,const char* fmt, ...)
+vui_log(int lf, const char* fmt, va_list ap, int with_errno, int force)
 {
-    int ret;
-    va_list ap;
-    va_start(ap, fmt);
-    pthread_mutex_lock(&_lock);
+    ui_line_t* ln;
+    va_list cp;
+    int len;
 
-    if ((vlog_msgf(_cnf->log_fd, lf, fmt, ap, 0)) < 0)
+    if (level_ < LOG_PRI(lf))
     {
-        pthread_mutex_lock(&_lock_wake);
-        signal_reconnect();
-        pthread_mutex_unlock(&_lock);
-        pthread_cond_wait(&_cond_wake, &_lock_wake);
-        pthread_mutex_unlock(&_lock_wake);
-        ret = -1;
+        return 0;
     }
-    else
+
+    va_copy(cp, ap);
+    len = format_log(NULL, 0, lf, fmt, cp, with_errno);
+    va_end(cp);
+
+    if ((ln = malloc(sizeof(*ln) + len + 1)) == NULL)
     {
-        pthread_mutex_unlock(&_lock);
-        ret = 0;
+        return -1;
     }
 
+    memset(ln, 0, sizeof(*ln));
+    ln->type = UI_LOG;
+    ln->len = format_log(ln->buf, len + 1, lf, fmt, ap, with_errno);
+    return push_ui_line(ln, force);
+}
+
+
+/**
+ *  Log a message to log filedescriptor.
+ *  The message is written by the output thread.
+ *  @param lf Log priority
+ *  @param fmt Format string
+ *  @param ... arguments
+ *  @return 0 on sucess, -1 in case of error
+ */
+int
+ui_log(int lf,const char* fmt, ...)
+{
+    int ret;
+    va_list ap;
+    va_start(ap, fmt);
+    ret = vui_log(lf, fmt, ap, 0, 0);
     va_end(ap);
-    return 0;
+    return ret;
 }
 
 /**
@@ -388,16 +838,12 @@ local_log(int lf, const char* fmt, ...)
 int
 ui_log_errno(int lf, const char* fmt, ...)
 {
+    int ret;
     va_list ap;
     va_start(ap, fmt);
-
-    if ((vlog_msgf(_cnf->log_fd, lf, fmt, ap, 1)) < 0)
-    {
-        return -1;
-    }
-
+    ret = vui_log(lf, fmt, ap, 1, 0);
     va_end(ap);
-    return 0;
+    return ret;
 }
 
 /**
@@ -416,7 +862,9 @@ local_log_errno(int lf, const char* fmt, ...)
 }
 
 /**
- * Prints an error message to stdout and log filedescriptor and terminates this program.
+ * Prints an error message to stdout and log subscribers and terminates this program.
+ * The output thread is given UI_FATAL_WAIT milliseconds to pass the message
+ * to the log subscribers.
  * @param fmt Format string
  * @param ... Arguments
 */
@@ -426,19 +874,26 @@ ui_fatal(char* fmt, ...)
     va_list args;
     va_start(args, fmt);
     vlog_msgf(STDOUT_FILENO, LOG_ERR, fmt, args, 0);
+    va_end(args);
 
-    // only write to log_fd if it is already initialized
-    if (_cnf->log_fd)
+    // only pass to log subscribers if the output thread is running
+    if (_ui_efd != -1)
     {
-        vlog_msgf(_cnf->log_fd, LOG_ERR, fmt, args, 0);
+        va_start(args, fmt);
+        vui_log(LOG_ERR, fmt, args, 0, 1);
+        va_end(args);
+
+        for (int i = 0; i < UI_FATAL_WAIT && __atomic_load_n(&_ui_head, __ATOMIC_ACQUIRE); i++)
+        {
+            usleep(1000);
+        }
     }
 
-    va_end(args);
     exit(EXIT_FAILURE);
 }
 
 /**
- * Prints usage of the program to stdout and log filedescriptor and terminates this program.
+ * Prints usage of the program to stdout and terminates this program.
  * @param exit_status Status of termination
  * @param options Array of options supported
  * @param Format string
@@ -453,24 +908,10 @@ usage(int exit_status, cli_options_t* options, const char* fmt, ...)
         va_list args;
         va_start(args, fmt);
         vlog_msgf(STDOUT_FILENO, LOG_ERR, fmt, args, 0);
-
-        // only write to log_fd if it is already initialized
-        if (_cnf->log_fd)
-        {
-            vlog_msgf(_cnf->log_fd, LOG_ERR, fmt, args, 0);
-        }
-
         va_end(args);
     }
 
     print_usage(STDOUT_FILENO, options);
-
-    // only write to log_fd if it is already initialized
-    if (_cnf->log_fd)
-    {
-        print_usage(_cnf->log_fd, options);
-    }
-
     exit(exit_status);
 }
 
@@ -528,99 +969,195 @@ print_usage(int fd, cli_options_t* options)
 int
 ui_read_line(char** line)
 {
-    if (!_cnf->in_fd)
+    int ret = read_line_sync(line);
+
+    if (ret > 0)
+    {
+        local_log(LOG_DEBUG, "INPUT: '%s'", *line);
+    }
+
+    return ret;
+}
+
+
+/**
+ * Cuts the first complete line out of the buffer of a line reader.
+ * @param rd Line reader
+ * @param line Receives the line allocated on the heap
+ * @return length of line, 0 if no complete line is buffered
+ */
+int
+cut_line(line_reader_t* rd, char** line)
+{
+    char* nl; // newline character within buffer
+    int len;  // length of line
+
+    if (!rd->len || (nl = memchr(rd->buf, '\n', rd->len)) == NULL)
+    {
+        return 0;
+    }
+
+    len = nl - rd->buf + 1;
+
+    if ((*line = malloc(len + 1)) == NULL)
+    {
+        ui_fatal("Memory allocation for input string failed!");
+    }
+
+    memcpy(*line, rd->buf, len);
+    (*line)[len] = '\0';
+    rd->len -= len;
+    memmove(rd->buf, rd->buf + len, rd->len);
+    return len;
+}
+
+
+/**
+ * Reads the next chunk of UI_READ_CHUNK bytes of an input client into
+ * the buffer of its line reader. Lines must not exceed UI_MAX_LINE bytes.
+ * @param rd Line reader of input client
+ * @return 0 on success, -1 on EOF, error or if the line is too long
+ */
+int
+fill_line_reader(line_reader_t* rd)
+{
+    char* alc_ptr; // used for realloc
+    int ret;
+
+    // lines are cut out before reading, thus the buffer holds no newline
+    if (rd->len >= UI_MAX_LINE)
     {
+        ui_log(LOG_WARN, "Line of UI client exceeds %d bytes!", UI_MAX_LINE);
         return -1;
     }
 
-    int ret = read_line_sync(_cnf->in_fd, line);
+    // make room for the next chunk
+    if (rd->size - rd->len < UI_READ_CHUNK)
+    {
+        if ((alc_ptr = realloc(rd->buf, rd->size + UI_READ_CHUNK)) == NULL)
+        {
+            ui_fatal("Reallocation of input buffer failed!");
+        }
 
-    if (ret > 0)
+        rd->buf = alc_ptr;
+        rd->size += UI_READ_CHUNK;
+    }
+
+    if ((ret = read(rd->fd, rd->buf + rd->len, rd->size - rd->len)) > 0)
     {
-        local_log(LOG_DEBUG, "INPUT: '%s'", *line);
+        rd->len += ret;
+        return 0;
     }
 
-    return ret;
+    return ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+}
+
+
+/**
+ * Accepts all pending connections of input clients.
+ * A slot is reused only after all complete lines of its previous client
+ * have been taken.
+ */
+void
+accept_input_clients()
+{
+    line_reader_t* rd;
+    int fd;
+    int i;
+
+    while ((fd = accept4(_ipc_out.fd, NULL, NULL, SOCK_NONBLOCK)) != -1)
+    {
+        for (i = 0; i < UI_MAX_CLIENTS && (_inp[i].fd != -1 || _inp[i].len); i++);
+
+        if (i == UI_MAX_CLIENTS)
+        {
+            local_log(LOG_WARN, "TOO MANY UI CLIENTS");
+            close(fd);
+            continue;
+        }
+
+        rd = &_inp[i];
+
+        if (watch_fd(_inp_epfd, fd, rd) == -1)
+        {
+            local_log_errno(LOG_ERR, "Registration at epoll instance failed!");
+            close(fd);
+            continue;
+        }
+
+        rd->fd = fd;
+        local_log(LOG_NOTICE, "UI CLIENT CONNECTED");
+    }
 }
 
 
 /**
- *  Read a line terminated with \\n from a file descriptor.
- *  Reads a line from the given file descriptor until \\n is found.
+ *  Read a line terminated with \\n from the input clients.
+ *  Blocks until one of the input clients has sent a whole line. Clients
+ *  are served round robin, every client has its own line reader so that
+ *  lines of several clients do not interleave. Data is read in chunks of
+ *  UI_READ_CHUNK bytes and lines are cut out of them, so pasting many
+ *  lines costs one read per chunk instead of one per byte.
  *  @param line Double pointer used for dynamic memory allocation since
  *              characters will be stored on the heap.
- *  @return: length of bytes read, 0 on EOF, -1 on error
+ *  @return: length of bytes read, -1 on error
  */
 int
-read_line_sync(int fd, char** line)
+read_line_sync(char** line)
 {
-    char* ptr;             // line pointer
-    char* alc_ptr = NULL;  // used for realloc
-    int len = 1;           // current length of string (at least 1 char)
-    int ret;               // return value
+    struct epoll_event ev[MAX_EVENTS]; // ready file descriptors
+    line_reader_t* rd;
+    int nfds;
+    int ret;
+    int i;
     *line = NULL;
 
-    do
+    while (1)
     {
-        // allocate memory for new character
-        alc_ptr = realloc(*line, len + 1);
-
-        if (alc_ptr == NULL)
+        for (i = 0; i < UI_MAX_CLIENTS; i++)
         {
-            if (*line != NULL)
+            rd = &_inp[(_inp_next + i) % UI_MAX_CLIENTS];
+
+            if ((ret = cut_line(rd, line)) > 0)
             {
-                free(*line);
+                _inp_next = (_inp_next + i + 1) % UI_MAX_CLIENTS;
+                return ret;
             }
 
-            ui_fatal("Reallocation of input string failed!");
+            // incomplete line of a disconnected client
+            if (rd->fd == -1)
+            {
+                rd->len = 0;
+            }
         }
 
-        *line = alc_ptr;
-        ptr = *line + len - 1;
-        len++;
+        if ((nfds = epoll_wait(_inp_epfd, ev, MAX_EVENTS, -1)) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -1;
+        }
 
-        do
+        for (i = 0; i < nfds; i++)
         {
-            pthread_mutex_lock(&_lock);
-            fd_set fds;
-            struct timeval tv;
-            FD_ZERO(&fds);
-            FD_SET(fd, &fds);
-            // non - blocking
-            tv.tv_sec = 0;
-            tv.tv_usec = 0;
-
-            // if data is available
-            if ((ret = select(fd + 1, &fds, NULL, NULL, &tv)) == 1)
+            if (ev[i].data.ptr == &_ipc_out)
             {
-                // on error or EOF of read
-                if ((ret = read(fd, ptr, 1)) <= 0)
-                {
-                    pthread_mutex_lock(&_lock_wake);
-                    signal_reconnect();
-                    pthread_mutex_unlock(&_lock);
-                    pthread_cond_wait(&_cond_wake, &_lock_wake);
-                    pthread_mutex_unlock(&_lock_wake);
-                    free(*line);
-                    return ret;
-                }
-                else
-                {
-                    pthread_mutex_unlock(&_lock);
-                    break;
-                }
+                accept_input_clients();
+                continue;
             }
 
-            pthread_mutex_unlock(&_lock);
-            tv.tv_sec = 0;
-            tv.tv_usec = 100; // 100ms
-            select(0, NULL, NULL, NULL, &tv);
+            rd = ev[i].data.ptr;
+
+            // lines received before EOF are still handed out
+            if (rd->fd != -1 && fill_line_reader(rd) == -1)
+            {
+                close(rd->fd);
+                rd->fd = -1;
+                local_log(LOG_NOTICE, "UI CLIENT DISCONNECTED");
+            }
         }
-        while (1);
     }
-    while (*ptr != '\n');
-
-    // terminate string
-    *(ptr + 1) = '\0';
-    return len - 1; // length of string excluding \0
 }
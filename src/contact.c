@@ -31,6 +31,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
 
 #include "dchat_h/contact.h"
 #include "dchat_h/types.h"
@@ -42,145 +46,412 @@
 
 /**
  *  Sends local contactlist to a contact.
- *  Sends all known contacts stored in the contactlist within the global config
- *  in form of a "control/discover" PDU to the given contact.
- *  @param n   Index of contact to whom we send our contactlist (excluding him)
- *  @return amount of bytes that have been written as content, -1 on error
+ *  Sends all known contacts stored in the contactlists of all workers
+ *  in form of a "control/discover" PDU to the given contact. The contacts
+ *  are read from the published directories of the workers. If the digest
+ *  of the contact is given, contacts it already knows are left out.
+ *  Contacts supporting binary contactlists get a "control/contacts" PDU
+ *  holding CONTACT_BINLEN bytes per contact instead. Contactlists exceeding
+ *  the content limit of the receiver are split into several PDUs.
+ *  @see send_digest()
+ *  @param self   Worker owning the contact
+ *  @param n      Index of contact to whom we send our contactlist (excluding him)
+ *  @param digest Digest received from the contact or NULL
+ *  @param len    Length of the digest in bytes
+ *  @return 0 if the contactlist has been sent or queued, -1 on error
  */
 int
-send_contacts(int n)
+send_contacts(worker_t* self, int n, unsigned char* digest, int len)
 {
     dchat_pdu_t pdu;    // pdu with contact information
     char* contact_str;  // pointer to a string representation of a contact
-    int i;
+    unsigned char* bin; // binary representation of a contact
+    int binary;         // send a binary contactlist?
+    int i, w;
     int ret;            // return value
-    int pdu_len = 0;    // total content length of pdu-packet that will be sent
-    contact_t* contact; // contact that will be converted to a string
+    int pdu_len = 0;    // total length of the contactlist that will be sent
+    int off, chunk;     // part of the contactlist sent with the next pdu
+    int limit;          // maximum content length accepted by the receiver
+    char* list;         // contactlist in its wire format
+    contact_t contact;  // contact that will be converted to a string
+    dir_entry_t* entry; // published contact
+    directory_t* dir;   // published contacts of a worker
     // initialize PDU
-    init_dchat_pdu(&pdu, 1.0, CTT_ID_DSC, _cnf->me.onion_id, _cnf->me.lport,
-                   _cnf->me.name);
-
-    // iterate through our contactlist
-    for (i = 0; i < _cnf->cl.cl_size; i++)
+    binary = CONTACT(self, n)->caps & CAP_BINLIST;
+    init_dchat_pdu(&pdu, 1.0, binary ? CTT_ID_CTL : CTT_ID_DSC, _cnf->me.onion_id,
+                   _cnf->me.lport, _cnf->me.name);
+    memset(&contact, 0, sizeof(contact));
+    sync_directory(self);
+    enter_directory(self);
+
+    // iterate through the directories of all workers
+    for (w = 0; w < _cnf->workers; w++)
     {
-        // except client n to whom we sent our contactlist
-        if (n == i)
+        dir = get_directory(&_cnf->wk[w]);
+
+        for (i = 0; dir != NULL && i < dir->cnt; i++)
         {
-            continue;
+            entry = &dir->entry[i];
+
+            // except client n to whom we sent our contactlist
+            if (&_cnf->wk[w] == self && entry->slot == n)
+            {
+                continue;
+            }
+
+            // if contact is not temporary (has not sent "control/discover" yet)
+            // and the receiver does not know it already
+            if (entry->lport != 0 &&
+                (digest == NULL || !in_digest(digest, len, entry->onion_id, entry->lport)))
+            {
+                if (binary)
+                {
+                    pdu.content = realloc(pdu.content, pdu_len + CONTACT_BINLEN);
+
+                    if (pdu.content == NULL)
+                    {
+                        ui_fatal("Memory reallocation for contactlist failed!");
+                    }
+
+                    // <onion-id (base32 decoded)> <port (network byte order)>
+                    bin = (unsigned char*) &pdu.content[pdu_len];
+
+                    if (onion_to_bin(entry->onion_id, bin) == -1)
+                    {
+                        ui_log(LOG_WARN, "Conversion of contact '%s' to binary failed! - Skipped",
+                               entry->name);
+                        continue;
+                    }
+
+                    bin[ONION_BINLEN] = entry->lport >> 8;
+                    bin[ONION_BINLEN + 1] = entry->lport & 0xff;
+                    pdu_len += CONTACT_BINLEN;
+                    continue;
+                }
+
+                memcpy(contact.onion_id, entry->onion_id, sizeof(contact.onion_id));
+                contact.lport = entry->lport;
+
+                // convert contact to a string
+                if ((contact_str = contact_to_string(&contact)) == NULL)
+                {
+                    ui_log(LOG_WARN, "Conversion of contact '%s' to string failed! - Skipped",
+                           entry->name);
+                    continue;
+                }
+
+                // (re)allocate memory for pdu for contact string
+                pdu.content = realloc(pdu.content, pdu_len + strlen(contact_str) + 1);
+
+                // could not allocate memory for content
+                if (pdu.content == NULL)
+                {
+                    ui_fatal("Memory reallocation for contactlist failed!");
+                }
+
+                pdu.content[pdu_len] = '\0'; // set the first byte to \0.. used for strcat
+                // add contact information to content
+                strncat(pdu.content, contact_str, strlen(contact_str));
+                // increase size of pdu content-length
+                pdu_len += strlen(contact_str);
+                free(contact_str);
+            }
         }
+    }
 
-        // temporarily point to a contact
-        contact = &(_cnf->cl.contact[i]);
+    leave_directory(self);
+    // the list is split into pdus the receiver accepts, peers without
+    // binary contactlists may enforce the old content limit
+    list = pdu.content;
+    limit = binary ? MAX_CONTACTS_LEN - MAX_CONTACTS_LEN % CONTACT_BINLEN : MAX_CONTENT_LEN;
+    off = 0;
+
+    // at least one pdu is sent, the first one identifies us
+    do
+    {
+        chunk = pdu_len - off;
 
-        // if its not an empty contact slot and contact is not temporary (has not sent "control/discover" yet)
-        if (contact->lport != 0)
+        if (chunk > limit)
         {
-            // convert contact to a string
-            if ((contact_str = contact_to_string(contact)) == NULL)
+            chunk = limit;
+
+            // text contacts must not be cut in the middle of a line
+            while (!binary && chunk > 0 && list[off + chunk - 1] != '\n')
             {
-                ui_log(LOG_WARN, "Conversion of contact '%s' to string failed! - Skipped",
-                       contact->name);
-                continue;
+                chunk--;
             }
 
-            // (re)allocate memory for pdu for contact string
-            pdu.content = realloc(pdu.content, pdu_len + strlen(contact_str) + 1);
-            pdu.content[pdu_len] = '\0'; // set the first byte to \0.. used for strcat
-
-            // could not allocate memory for content
-            if (pdu.content == NULL)
+            if (chunk == 0)
             {
-                ui_fatal("Memory reallocation for contactlist failed!");
+                ui_log(LOG_ERR, "Contact exceeds the content limit of the receiver!");
+                ret = -1;
+                break;
             }
+        }
+
+        pdu.content = list == NULL ? NULL : list + off;
+        pdu.content_length = chunk;
+
+        // send pdu including the next part of our contacts
+        if ((ret = send_pdu(self, CONTACT(self, n), &pdu)) == -1)
+        {
+            ui_log(LOG_ERR, "Sending of contactlist failed!");
+            break;
+        }
+
+        off += chunk;
+    }
+    while (off < pdu_len);
+
+    if (list != NULL)
+    {
+        free(list);
+    }
+
+    free(pdu.server);
+    return ret;
+}
+
+
+/**
+ *  Sends an empty "control/discover" PDU to a contact we connected to.
+ *  It announces our identity and capabilities, so that the contact can
+ *  choose how to exchange contactlists with us.
+ *  @param self Worker owning the contact
+ *  @param n    Index of contact
+ *  @return 0 if the PDU has been sent or queued, -1 on error
+ */
+int
+send_announce(worker_t* self, int n)
+{
+    dchat_pdu_t pdu; // pdu announcing us
+    int ret;
+
+    init_dchat_pdu(&pdu, 1.0, CTT_ID_DSC, _cnf->me.onion_id, _cnf->me.lport,
+                   _cnf->me.name);
+
+    if ((ret = send_pdu(self, CONTACT(self, n), &pdu)) == -1)
+    {
+        ui_log(LOG_ERR, "Sending of announcement failed!");
+    }
+
+    free(pdu.server);
+    return ret;
+}
+
+
+/**
+ *  Computes the position of a contact's bit in a digest.
+ *  The positions are derived from two hashes of the contact (double
+ *  hashing), every contact sets DIGEST_HASHES bits.
+ *  @param onion_id Onion address of contact
+ *  @param lport    Listening port of contact
+ *  @param i        Number of hash, 0 - DIGEST_HASHES - 1
+ *  @param bits     Size of digest in bits
+ *  @return position of bit
+ */
+unsigned
+digest_bit(char* onion_id, uint16_t lport, int i, unsigned bits)
+{
+    unsigned h1 = hash_contact(onion_id, lport);
+    unsigned h2 = (h1 >> 17 | h1 << 15) * 0x85ebca6bu | 1;
+
+    return (h1 + i * h2) % bits;
+}
+
+
+/**
+ *  Checks if a contact is contained in a digest.
+ *  A digest may report contacts which are not contained (false positive),
+ *  but never misses a contained one.
+ *  @param digest Digest to check
+ *  @param len    Length of the digest in bytes
+ *  @param onion_id Onion address of contact
+ *  @param lport    Listening port of contact
+ *  @return 1 if the contact is contained, 0 otherwise
+ */
+int
+in_digest(unsigned char* digest, int len, char* onion_id, uint16_t lport)
+{
+    unsigned b;
+
+    if (len <= 0)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < DIGEST_HASHES; i++)
+    {
+        b = digest_bit(onion_id, lport, i, len * 8);
 
-            // add contact information to content
-            strncat(pdu.content, contact_str, strlen(contact_str));
-            // increase size of pdu content-length
-            pdu_len += strlen(contact_str);
-            free(contact_str);
+        if (!(digest[b / 8] & (1 << (b % 8))))
+        {
+            return 0;
         }
     }
 
-    // set content-length of this pdu
-    pdu.content_length = pdu_len;
+    return 1;
+}
+
+
+/**
+ *  Sends a digest of the local contactlist to a contact.
+ *  The digest is a Bloom filter of all known contacts sent as
+ *  "control/digest" PDU. The contact answers with those of its contacts
+ *  which are not contained, hence joining a chat costs traffic in the
+ *  amount of contacts missing on either side instead of all contacts.
+ *  Only contacts who announced the capability get a digest.
+ *  @param self Worker owning the contact
+ *  @param n    Index of contact to whom the digest is sent
+ *  @return 0 if the digest has been sent or queued, -1 on error
+ */
+int
+send_digest(worker_t* self, int n)
+{
+    dchat_pdu_t pdu;       // pdu with digest
+    unsigned char* digest; // Bloom filter of contacts
+    directory_t* dir;      // published contacts of a worker
+    dir_entry_t* entry;    // published contact
+    int cnt = 1;           // contacts contained, including us
+    int len;               // length of digest in bytes
+    int ret;
+    unsigned b;
+    int i, w;
+
+    init_dchat_pdu(&pdu, 1.0, CTT_ID_DGT, _cnf->me.onion_id, _cnf->me.lport,
+                   _cnf->me.name);
+    sync_directory(self);
+    enter_directory(self);
+
+    for (w = 0; w < _cnf->workers; w++)
+    {
+        dir = get_directory(&_cnf->wk[w]);
+        cnt += dir != NULL ? dir->cnt : 0;
+    }
+
+    // bits per contact determine the rate of false positives
+    len = (cnt * DIGEST_BITS + 7) / 8;
+    len = len < DIGEST_MIN ? DIGEST_MIN : len > content_limit(CTT_ID_DGT) ?
+          content_limit(CTT_ID_DGT) : len;
+
+    if ((digest = calloc(len, 1)) == NULL)
+    {
+        ui_fatal("Memory allocation for digest failed!");
+    }
+
+    for (i = 0; i < DIGEST_HASHES; i++)
+    {
+        b = digest_bit(_cnf->me.onion_id, _cnf->me.lport, i, len * 8);
+        digest[b / 8] |= 1 << (b % 8);
+    }
 
-    // write pdu inkluding all addresses of our contacts
-    if ((ret = write_pdu(_cnf->cl.contact[n].fd, &pdu)) == -1)
+    for (w = 0; w < _cnf->workers; w++)
     {
-        ui_log(LOG_ERR, "Sending of contactlist failed!");
+        dir = get_directory(&_cnf->wk[w]);
+
+        for (int j = 0; dir != NULL && j < dir->cnt; j++)
+        {
+            entry = &dir->entry[j];
+
+            if (!entry->lport)
+            {
+                continue;
+            }
+
+            for (i = 0; i < DIGEST_HASHES; i++)
+            {
+                b = digest_bit(entry->onion_id, entry->lport, i, len * 8);
+                digest[b / 8] |= 1 << (b % 8);
+            }
+        }
     }
 
-    if (pdu.content_length != 0)
+    leave_directory(self);
+    pdu.content = (char*) digest;
+    pdu.content_length = len;
+
+    if ((ret = send_pdu(self, CONTACT(self, n), &pdu)) == -1)
     {
-        free(pdu.content);
+        ui_log(LOG_ERR, "Sending of digest failed!");
     }
 
+    free(digest);
+    free(pdu.server);
     return ret;
 }
 
 
 /**
  *  Contacts transferred via PDU will be added to the contactlist.
- *  Parses the contact information stored in the given PDU, connects to this remote client
- *  , if this client is unknown, the local contactlist within the global config will be sent
- *  to him. Finally the remote client is added as contact to the local contactlist.
- *  For every parsed contact information, this procedure is repeated.
- *  @param pdu PDU with the contact information in its content
- *  @return amount of new contacts added to the contactlist, -1 on error
+ *  Parses the contact information stored in the given PDU. For every
+ *  contact which is unknown to all workers, a connection request is passed
+ *  to the connector, which hands the new connection to a worker. The
+ *  local contactlist will be sent to the new contact by this worker.
+ *  Both "control/discover" and binary "control/contacts" PDUs are accepted.
+ *  @param self Worker which received the PDU
+ *  @param pdu  PDU with the contact information in its content
+ *  @return amount of new contacts requested, -1 on error
  */
 int
-receive_contacts(dchat_pdu_t* pdu)
+receive_contacts(worker_t* self, dchat_pdu_t* pdu)
 {
     contact_t contact;
     int ret = 0;            // return value
     int new_contacts = 0;   // stores how many new contacts have been received
-    int known_contacts = 0; // stores how many known contacts have been received
-    int line_begin = 0;     // offset of content of given pdu
-    int line_end = 0;       // offset (end) of content of given pdu
-    char* line;             // contact string
+    int offset = 0;         // offset of the next line within the content
+    int len;                // length of the current line
+    int found;              // result of the line iterator
+    char* line;             // contact line, points into the content
+    unsigned char* bin;     // binary contact, points into the content
 
-    // as long as the line_end index is lower than content-length
-    while (line_end < pdu->content_length)
+    if (pdu->content_type == CTT_ID_CTL)
     {
-        line_begin = line_end;
+        if (pdu->content_length % CONTACT_BINLEN)
+        {
+            ui_log(LOG_ERR, "Binary contactlist has an invalid length!");
+            return -1;
+        }
 
-        // extract a line from the content of the pdu
-        if ((line_end = get_content_part(pdu, line_begin, '\n', &line)) == -1)
+        for (bin = (unsigned char*) pdu->content;
+             offset < pdu->content_length; offset += CONTACT_BINLEN, bin += CONTACT_BINLEN)
         {
-            ui_log(LOG_ERR, "Extraction of contact line from received PDU failed!");
-            ret = -1;
-            break;
+            bin_to_onion(bin, contact.onion_id);
+            contact.lport = bin[ONION_BINLEN] << 8 | bin[ONION_BINLEN + 1];
+
+            if ((found = learn_contact(self, &contact)) == -1)
+            {
+                ret = -1;
+            }
+
+            new_contacts += found == 1;
         }
 
-        // parse line ane make string to contact
-        if (string_to_contact(&contact, line) == -1)
+        return ret != -1 ? new_contacts : -1;
+    }
+
+    // walk the content line by line without copying it
+    while ((found = next_content_line(pdu, &offset, '\n', &line, &len)) == 1)
+    {
+        // parse line and make string to contact
+        if (parse_contact(&contact, line, len) == -1)
         {
             ui_log(LOG_WARN, "Conversion of string to contact failed! - Skipped");
             ret = -1;
             continue;
         }
 
-        // if parsed contact is unknown
-        if (find_contact(&contact, 0) == -2)
-        {
-            // increment new contacts counter
-            new_contacts++;
-
-            // connect to new contact, add him as contact, and send contactlist to him
-            if (handle_local_conn_request(contact.onion_id, contact.lport) == -1)
-            {
-                ui_log(LOG_WARN, "Connection to new contact failed!");
-                ret = -1;
-            }
-        }
-        else
+        if ((found = learn_contact(self, &contact)) == -1)
         {
-            // we found parsed contact in contactlist -> increment known contacts counter
-            known_contacts++;
+            ret = -1;
         }
 
-        // increment end of line index, to point to the beginning of the next line
-        line_end++;
+        new_contacts += found == 1;
+    }
+
+    if (found == -1)
+    {
+        ui_log(LOG_ERR, "Extraction of contact line from received PDU failed!");
+        ret = -1;
     }
 
     return ret != -1 ? new_contacts : -1;
@@ -188,91 +459,287 @@ receive_contacts(dchat_pdu_t* pdu)
 
 
 /**
- *  Checks the local contactlist for duplicates.
- *  Checks if there are duplicate contacts in the contactlist. Contacts
- *  with the same listening port and ip address are considered as duplicate.
- *  If there are duplicates, the index of the contact which should be deleted
- *  will be returned. This function implements the duplicate detection
- *  mechanismn of the DChat protocol. Therefore for further information read
- *  the DChat protocol specification for detecting and removing duplicates.
- *  @see find_contact()
- *  @param n   Index of contact to check for duplicates
- *  @return index of duplicate, -1 if there are no duplicates or if contact
- *  is not in the contactlist
+ *  Requests a connection to a received contact if it is unknown.
+ *  @param self    Worker which received the contact
+ *  @param contact Received contact
+ *  @return 1 if a connection has been requested, 0 if the contact is
+ *          already known, -1 on error
  */
 int
-check_duplicates(int n)
+learn_contact(worker_t* self, contact_t* contact)
 {
-    int fst_oc;              // index of first occurance of contact
-    int sec_oc;              // index of duplicate
-    contact_t* temp;         // temporay contact variable
-    int connect_contact = 0; // index of contact to whom we connected to
-    int accept_contact = 0;  // index of contact from whom we accepted a connection
-    int ret;
-    // check if given contact is in the contactlist
-    fst_oc = find_contact(&_cnf->cl.contact[n], 0);
+    if (!is_valid_port(contact->lport))
+    {
+        ui_log(LOG_WARN, "Invalid port of received contact! - Skipped");
+        return -1;
+    }
 
-    // contact is this client
-    if (fst_oc == -1)
+    // we found the contact in a contactlist or it is ourself
+    if (same_contact(contact, &_cnf->me) ||
+        locate_contact(self, contact, NULL, NULL) != NULL)
     {
-        return n;
+        return 0;
     }
 
-    if (fst_oc == -2)
+    // let the connector connect to the new contact
+    if (request_connection(&self->connect_rq, contact->onion_id, contact->lport) == -1)
     {
-        return -1; // contact not in list
+        ui_log(LOG_WARN, "Connection to new contact failed!");
+        return -1;
     }
 
-    // check if given contact is in the contactlist a second time
-    sec_oc = find_contact(&_cnf->cl.contact[n], fst_oc + 1);
+    return 1;
+}
+
+
+/**
+ *  Sends a PDU to all contacts.
+ *  @see broadcast_pdus()
+ *  @param pdu Pointer to the PDU which will be sent
+ *  @return 0 on success, -1 if the PDU could not be encoded
+ */
+int
+broadcast_pdu(dchat_pdu_t* pdu)
+{
+    return broadcast_pdus(pdu, 1);
+}
+
+
+/**
+ *  Sends several PDUs to all contacts.
+ *  Every PDU is encoded only once as text, as text in session mode and as
+ *  binary frame. A reference of all wire buffers is passed to every worker,
+ *  which queues one of them for each of its contacts. Thus the encoding
+ *  costs do not depend on the amount of contacts. The PDUs are passed to
+ *  a worker at once, so that they are written together.
+ *  @see deliver_wire_buf()
+ *  @param pdu Array of PDUs which will be sent
+ *  @param cnt Amount of PDUs
+ *  @return 0 on success, -1 if a PDU could not be encoded
+ */
+int
+broadcast_pdus(dchat_pdu_t* pdu, int cnt)
+{
+    worker_msg_t* msg;  // messages passed to workers
+    int ret = 0;        // return value
+    int i, w, n = 0;
 
-    if (sec_oc == -2)
+    if ((msg = calloc(cnt, sizeof(*msg))) == NULL)
     {
-        return -1; // no duplicate contact
+        ui_fatal("Memory allocation for worker messages failed!");
     }
 
-    // extract port of sockaddr_storage structure
-    temp = &_cnf->cl.contact[fst_oc];
+    for (i = 0; i < cnt; i++)
+    {
+        msg[n].type = MSG_SEND;
+
+        // session PDUs and frames omit our identity, contacts get it with
+        // their first PDU
+        if ((msg[n].wb = encode_pdu(&pdu[i], 1)) == NULL ||
+            (msg[n].sb = encode_pdu(&pdu[i], 0)) == NULL ||
+            (msg[n].fb = encode_frame(&pdu[i], 0)) == NULL)
+        {
+            ui_log(LOG_ERR, "Encoding of PDU failed!");
+            release_msg(&msg[n]);
+            ret = -1;
+            continue;
+        }
+
+        n++;
+    }
 
-    // which kind of contact has to be deleted?
-    if (temp->accepted)
+    for (w = 0; w < _cnf->workers && n; w++)
     {
-        accept_contact = fst_oc;
-        connect_contact = sec_oc;
+        for (i = 0; i < n; i++)
+        {
+            hold_wire_buf(msg[i].wb);
+            hold_wire_buf(msg[i].sb);
+            hold_wire_buf(msg[i].fb);
+        }
+
+        post_msgs(&_cnf->wk[w], msg, n);
     }
-    else
+
+    for (i = 0; i < n; i++)
     {
-        connect_contact = fst_oc;
-        accept_contact = sec_oc;
+        release_msg(&msg[i]);
     }
 
-    // if local onion address is greater than the remote one
-    // than the index of the  contact, who got added because of a "connect",
-    // will be returned
-    ret = strcmp(_cnf->me.onion_id, _cnf->cl.contact[n].onion_id);
+    free(msg);
+    return ret;
+}
 
-    if (ret > 0)
+
+/**
+ *  Releases the wire buffers of a MSG_SEND message.
+ *  @param msg Pointer to the message
+ */
+void
+release_msg(worker_msg_t* msg)
+{
+    if (msg->wb != NULL)
     {
-        return connect_contact;
+        release_wire_buf(msg->wb);
     }
-    // otherwise it is the other way round
-    else if (ret < 0)
+
+    if (msg->sb != NULL)
     {
-        return accept_contact;
+        release_wire_buf(msg->sb);
     }
-    // if ip addresses are equal, do the same for the listening port
-    else if (_cnf->me.lport > _cnf->cl.contact[n].lport)
+
+    if (msg->fb != NULL)
     {
-        return connect_contact;
+        release_wire_buf(msg->fb);
     }
-    else if (_cnf->me.lport < _cnf->cl.contact[n].lport)
+
+    memset(msg, 0, sizeof(*msg));
+}
+
+
+/**
+ *  Queues a broadcast PDU for all contacts of a worker.
+ *  Every contact gets the encoding chosen by pick_wire_buf(). The send
+ *  queues are flushed after all messages of the inbox have been handled.
+ *  @see flush_contacts()
+ *  @param self Worker whose contacts receive the PDU
+ *  @param msg  MSG_SEND message holding the encodings of the PDU
+ */
+void
+deliver_wire_buf(worker_t* self, worker_msg_t* msg)
+{
+    contact_t* contact; // receiving contact
+    int i;
+
+    for (i = 0; i < self->cl.cl_size; i++)
     {
-        return accept_contact;
+        contact = CONTACT(self, i);
+
+        if (contact->fd)
+        {
+            queue_wire_buf(self, contact, pick_wire_buf(contact, msg));
+        }
     }
-    else
+}
+
+
+/**
+ *  Flushes the send queues of all contacts of a worker.
+ *  Contacts waiting for writability are left out, they are flushed as
+ *  soon as epoll(7) reports them writable.
+ *  @param self Worker whose contacts are flushed
+ */
+void
+flush_contacts(worker_t* self)
+{
+    contact_t* contact; // contact whose queue is flushed
+    int i;
+
+    for (i = 0; i < self->cl.cl_size; i++)
+    {
+        contact = CONTACT(self, i);
+
+        if (!contact->fd || !contact->oq.cnt || (contact->events & EPOLLOUT))
+        {
+            continue;
+        }
+
+        // a contact whose socket failed will be removed as soon as
+        // its read side reports the error or EOF
+        if (flush_contact(self, contact) == -1)
+        {
+            ui_log(LOG_WARN, "Sending to contact '%s' failed!", contact->name);
+        }
+    }
+}
+
+
+/**
+ *  Chooses the encoding of a broadcast PDU for a contact.
+ *  Encodings omitting our identity are chosen only if it has already
+ *  been sent to the contact. Binary frames are preferred over text in
+ *  session mode.
+ *  @param contact Pointer to the receiving contact
+ *  @param msg     MSG_SEND message holding the encodings of the PDU
+ *  @return the wire buffer which should be queued
+ */
+wire_buf_t*
+pick_wire_buf(contact_t* contact, worker_msg_t* msg)
+{
+    int sent = contact->ident_sent; // does the contact know our identity?
+
+    contact->ident_sent = 1;
+
+    if (sent && (contact->caps & CAP_FRAME))
+    {
+        return msg->fb;
+    }
+
+    if (sent && (contact->caps & CAP_SESSION))
+    {
+        return msg->sb;
+    }
+
+    return msg->wb;
+}
+
+
+/**
+ *  Checks the contactlists for duplicates.
+ *  Checks if there is a duplicate of the given contact in the contactlist of
+ *  any worker. Contacts with the same listening port and onion address are
+ *  considered as duplicate. This function implements the duplicate detection
+ *  mechanismn of the DChat protocol. Therefore for further information read
+ *  the DChat protocol specification for detecting and removing duplicates.
+ *  If the duplicate has to be deleted, a message is passed to the worker
+ *  owning it.
+ *  @see locate_contact()
+ *  @param self Worker owning the contact
+ *  @param n    Index of contact to check for duplicates
+ *  @return n if the given contact has to be deleted, -1 otherwise
+ */
+int
+check_duplicates(worker_t* self, int n)
+{
+    contact_t* contact;      // contact to check
+    dir_entry_t other;       // copy of duplicate
+    worker_t* wk;            // worker owning the duplicate
+    worker_msg_t msg;        // message to delete the duplicate
+    int del_connect;         // delete contact to whom we connected to?
+    int ret;
+    contact = CONTACT(self, n);
+
+    // contact is this client
+    if (same_contact(contact, &_cnf->me))
+    {
+        return n;
+    }
+
+    // check if given contact is known a second time
+    if ((wk = locate_contact(self, contact, contact, &other)) == NULL)
+    {
+        return -1; // no duplicate contact
+    }
+
+    // if local onion address is greater than the remote one
+    // than the contact, who got added because of a "connect",
+    // will be deleted, otherwise it is the other way round
+    // if onion addresses are equal, do the same for the listening port
+    ret = strcmp(_cnf->me.onion_id, contact->onion_id);
+    del_connect = ret > 0 || (!ret && _cnf->me.lport > contact->lport);
+
+    // which kind of contact has to be deleted?
+    if (other.accepted == del_connect)
     {
-        return accept_contact;
+        return n;
     }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = MSG_DEL;
+    msg.fd = other.fd;
+    msg.lport = other.lport;
+    memcpy(msg.onion_id, other.onion_id, ONION_ADDRLEN);
+    post_msg(wk, &msg);
+    return -1;
 }
 
 
@@ -331,233 +798,906 @@ contact_to_string(contact_t* contact)
  *  The string has to be in the form of: <onion-id> <port>\n
  *  Further details can be found in the DChat protocol specification
  *  @see contact_to_string()
+ *  @see parse_contact()
  *  @param contact: Pointer to contact that should be converted to a string
  *  @return 0 if conversion was successful, -1 on error
  */
 int
 string_to_contact(contact_t* contact, char* string)
 {
-    char* onion_id; // onion address string (splitted from line)
-    char* port;     // port string (splitted from line)
-    int lport;      // converted listening port
-    char* ptr;      // used for strtol
-    char* save_ptr; // pointer for strtok_r
+    return parse_contact(contact, string, strcspn(string, "\n"));
+}
 
-    // split onion-id from string
-    if ((onion_id = strtok_r(string, " ", &save_ptr)) == NULL)
-    {
-        ui_log(LOG_ERR, "Missing onion-id in contact string!");
-        return -1;
-    }
 
-    // split port from string
-    if ((port = strtok_r(NULL, "\n", &save_ptr)) == NULL)
+/**
+ *  Parses a contact line in place.
+ *  The line has to be in the form of: <onion-id> <port>
+ *  and does not have to be null-terminated. Nothing is allocated: the
+ *  onion-id is validated within the contact and the port is converted
+ *  digit by digit, rejecting signs, blanks and values out of range.
+ *  @param contact Pointer to contact where the result will be stored
+ *  @param line    Pointer to the beginning of the line
+ *  @param len     Length of the line without its terminating character
+ *  @return 0 if the line could be parsed, -1 on error
+ */
+int
+parse_contact(contact_t* contact, const char* line, int len)
+{
+    int lport = 0; // converted listening port
+    int i;
+
+    // onion-id, a single blank and at least one digit
+    if (len < ONION_ADDRLEN + 2 || line[ONION_ADDRLEN] != ' ')
     {
-        ui_log(LOG_ERR, "Missing listening port in contact string!");
+        ui_log(LOG_ERR, "Missing onion-id or listening port in contact string!");
         return -1;
     }
 
-    if (!is_valid_onion(onion_id))
+    memcpy(contact->onion_id, line, ONION_ADDRLEN);
+    contact->onion_id[ONION_ADDRLEN] = '\0';
+
+    if (!is_valid_onion(contact->onion_id))
     {
         ui_log(LOG_ERR, "Invalid onion-id of contact string!");
         return -1;
     }
 
-    // could line be splittet into ip and port?
-    // convert port string to integer
-    lport = (int) strtol(port, &ptr, 10);
-
-    if (ptr[0] != '\0' || !is_valid_port(lport))
+    for (i = ONION_ADDRLEN + 1; i < len; i++)
+    {
+        if (line[i] < '0' || line[i] > '9' || lport > 65535)
+        {
+            ui_log(LOG_ERR, "Invalid port of contact string!");
+            return -1;
+        }
+
+        lport = lport * 10 + (line[i] - '0');
+    }
+
+    if (!is_valid_port(lport))
     {
         ui_log(LOG_ERR, "Invalid port of contact string!");
         return -1;
     }
 
     contact->lport = lport;
-    contact->onion_id[0] = '\0';
-    strncat(contact->onion_id, onion_id, ONION_ADDRLEN);
     return 0;
 }
 
 
 /**
- *  Resizes the contactlist.
- *  Function to resize the contactlist to a given size. Old contacts are copied to the new
- *  resized contact list if they fit in it
- *  @param newsize New size of the contactlist
+ *  Appends a wire buffer to the send queue of a contact.
+ *  The queue acquires its own reference of the wire buffer.
+ *  @param self    Worker owning the contact
+ *  @param contact Pointer to the contact
+ *  @param wb      Pointer to the wire buffer
+ *  @return 0 on success, -1 on error
+ */
+int
+queue_wire_buf(worker_t* self, contact_t* contact, wire_buf_t* wb)
+{
+    out_queue_t* oq = &contact->oq;
+    wire_buf_t** ring;  // enlarged ring
+    int i;
+
+    // enlarge ring if it is full
+    if (oq->cnt == oq->size)
+    {
+        if ((ring = malloc((oq->size + INIT_QUEUE) * sizeof(*ring))) == NULL)
+        {
+            ui_fatal("Memory allocation for send queue failed!");
+        }
+
+        // copy queued buffers to the beginning of the new ring
+        for (i = 0; i < oq->cnt; i++)
+        {
+            ring[i] = oq->wb[(oq->head + i) % oq->size];
+        }
+
+        free(oq->wb);
+        oq->wb = ring;
+        oq->head = 0;
+        oq->size += INIT_QUEUE;
+    }
+
+    hold_wire_buf(wb);
+    oq->wb[(oq->head + oq->cnt) % oq->size] = wb;
+    oq->cnt++;
+    oq->bytes += wb->len;
+
+    // remember when the queue became congested
+    if (!oq->congested && oq->bytes > _cnf->qhigh)
+    {
+        oq->congested = mono_time();
+        self->cl.congested++;
+        ui_log(LOG_INFO, "Send queue of contact '%s' exceeds %d bytes!",
+               contact->name, _cnf->qhigh);
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Writes the send queue of a contact to its socket.
+ *  Queued wire buffers are written with writev(2), several at once.
+ *  Buffers which have been written completely are released. The function
+ *  does not block: if the socket is not writable anymore, the rest stays
+ *  queued until the socket becomes writable again.
+ *  @param self    Worker owning the contact
+ *  @param contact Pointer to the contact
+ *  @return amount of bytes still queued, -1 on error
+ */
+int
+flush_contact(worker_t* self, contact_t* contact)
+{
+    out_queue_t* oq = &contact->oq;
+    struct iovec iov[FLUSH_IOV];  // queued buffers
+    wire_buf_t* wb;               // first queued buffer
+    ssize_t ret;
+    int i, cnt;
+
+    while (oq->cnt)
+    {
+        cnt = oq->cnt < FLUSH_IOV ? oq->cnt : FLUSH_IOV;
+
+        for (i = 0; i < cnt; i++)
+        {
+            wb = oq->wb[(oq->head + i) % oq->size];
+            iov[i].iov_base = wb->data;
+            iov[i].iov_len  = wb->len;
+        }
+
+        // skip bytes already written of the first buffer
+        iov[0].iov_base = (char*) iov[0].iov_base + oq->off;
+        iov[0].iov_len -= oq->off;
+
+        if ((ret = writev(contact->fd, iov, cnt)) == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            else if (errno != EINTR)
+            {
+                return -1;
+            }
+
+            continue;
+        }
+
+        oq->bytes -= ret;
+        ret += oq->off;
+
+        // release buffers which have been written completely
+        while (oq->cnt && ret >= oq->wb[oq->head]->len)
+        {
+            ret -= oq->wb[oq->head]->len;
+            release_wire_buf(oq->wb[oq->head]);
+            oq->head = (oq->head + 1) % oq->size;
+            oq->cnt--;
+        }
+
+        oq->off = ret;
+    }
+
+    // queue has drained below low watermark
+    if (oq->congested && oq->bytes <= _cnf->qlow)
+    {
+        oq->congested = 0;
+        self->cl.congested--;
+        ui_log(LOG_INFO, "Send queue of contact '%s' has drained!",
+               contact->name);
+    }
+
+    // wait for writability only as long as data is queued
+    if (watch_contact(self, contact, EPOLL_CTL_MOD) == -1)
+    {
+        return -1;
+    }
+
+    return oq->bytes;
+}
+
+
+/**
+ *  Checks if a contact is too slow to receive its send queue.
+ *  A contact is too slow if its queue has been congested for longer
+ *  than the configured timeout.
+ *  @param contact Pointer to the contact
+ *  @param now     Current time of the monotonic clock
+ *  @return 1 if the contact should be disconnected, 0 otherwise
+ */
+int
+is_slow_contact(contact_t* contact, time_t now)
+{
+    out_queue_t* oq = &contact->oq;
+
+    if (!oq->congested)
+    {
+        return 0;
+    }
+
+    return now - oq->congested >= _cnf->qtimeout;
+}
+
+
+/**
+ *  Sends a PDU to a single contact.
+ *  The PDU is appended to the send queue of the contact, so that it is
+ *  sent after all PDUs already queued. The queue is flushed immediately,
+ *  data which cannot be written without blocking stays queued.
+ *  @see broadcast_pdu()
+ *  @param self    Worker owning the contact
+ *  @param contact Pointer to the contact
+ *  @param pdu     Pointer to the PDU
+ *  @return 0 on success, -1 on error
+ */
+int
+send_pdu(worker_t* self, contact_t* contact, dchat_pdu_t* pdu)
+{
+    wire_buf_t* wb; // encoded PDU
+    int ret;
+
+    // the first PDU sent to a contact carries our identity, in session
+    // mode it is omitted afterwards
+    if (contact->caps & CAP_FRAME)
+    {
+        wb = encode_frame(pdu, !contact->ident_sent);
+    }
+    else
+    {
+        wb = encode_pdu(pdu, !contact->ident_sent || !(contact->caps & CAP_SESSION));
+    }
+
+    if (wb == NULL)
+    {
+        ui_log(LOG_ERR, "Encoding of PDU failed!");
+        return -1;
+    }
+
+    contact->ident_sent = 1;
+
+    ret = queue_wire_buf(self, contact, wb);
+    release_wire_buf(wb);
+
+    if (ret == -1 || flush_contact(self, contact) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Frees the send queue of a contact.
+ *  All queued wire buffers are released.
+ *  @param self Worker owning the send queue
+ *  @param oq   Pointer to the send queue
+ */
+void
+free_queue(worker_t* self, out_queue_t* oq)
+{
+    if (oq->congested)
+    {
+        self->cl.congested--;
+    }
+
+    for (; oq->cnt; oq->cnt--)
+    {
+        release_wire_buf(oq->wb[oq->head]);
+        oq->head = (oq->head + 1) % oq->size;
+    }
+
+    free(oq->wb);
+    memset(oq, 0, sizeof(*oq));
+}
+
+
+/**
+ *  Registers the socket of a contact at the epoll(7) instance of its
+ *  worker. The event data points to the contact itself. Writability
+ *  is only watched as long as data is queued for the contact. If the
+ *  registered events would not change, nothing is done.
+ *  @param self    Worker owning the contact
+ *  @param contact Pointer to the contact
+ *  @param op      EPOLL_CTL_ADD or EPOLL_CTL_MOD
  *  @return 0 on success, -1 on error
  */
 int
-realloc_contactlist(int newsize)
+watch_contact(worker_t* self, contact_t* contact, int op)
 {
-    int i, j = 0;
-    contact_t* new_contact_list;
-    contact_t* old_contact_list;
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (contact->oq.cnt ? EPOLLOUT : 0);
+    ev.data.ptr = contact;
+
+    if (op == EPOLL_CTL_MOD && ev.events == contact->events)
+    {
+        return 0;
+    }
 
-    // size may not be lower than 1 and not be lower than the amount of contacts actually used
-    if (newsize < 1 || newsize < _cnf->cl.used_contacts)
+    if (epoll_ctl(self->epfd, op, contact->fd, &ev) == -1)
     {
-        ui_log(LOG_ERR,
-               "New size of contactlist must not be lower than 1 or the amount of contacts actually stored in the contactlist!");
+        ui_log_errno(LOG_ERR, "Registration of contact '%s' failed!",
+                     contact->name);
         return -1;
     }
 
-    // pointer to beginning of old contactlist
-    old_contact_list = &(_cnf->cl.contact[0]);
+    contact->events = ev.events;
+    return 0;
+}
+
 
-    // reserve memory for new contactlist
-    if ((new_contact_list = malloc(newsize * sizeof(contact_t))) == NULL)
+/**
+ *  Grows the contactlist of a worker by a chunk of INIT_CONTACTS contacts.
+ *  Existing contacts are never moved, hence indices and pointers to them
+ *  stay valid. The slots of the new chunk are put on the free-list and the
+ *  hash index is rebuilt if it has less buckets than slots.
+ *  @param self Worker owning the contactlist
+ *  @return 0 on success, -1 on error
+ */
+int
+grow_contactlist(worker_t* self)
+{
+    contactlist_t* cl = &self->cl;
+    int chunks = cl->cl_size / INIT_CONTACTS; // chunks allocated so far
+    int buckets = 1;                          // buckets of new hash index
+    int i;
+
+    if ((cl->chunk = realloc(cl->chunk, (chunks + 1) * sizeof(contact_t*))) == NULL ||
+        (cl->chunk[chunks] = calloc(INIT_CONTACTS, sizeof(contact_t))) == NULL)
     {
         ui_fatal("Reallocation of contactlist failed!");
     }
 
-    // zero out new contactlist
-    memset(new_contact_list, 0, newsize * sizeof(contact_t));
+    // link new slots to the free-list
+    for (i = 0; i < INIT_CONTACTS; i++)
+    {
+        cl->chunk[chunks][i].next = i < INIT_CONTACTS - 1 ? cl->cl_size + i + 1 : -1;
+    }
+
+    cl->free_slot = cl->cl_size;
+    cl->cl_size += INIT_CONTACTS;
+
+    if (cl->buckets >= cl->cl_size)
+    {
+        return 0;
+    }
+
+    // hash index has at least as many buckets as slots
+    for (; buckets < cl->cl_size; buckets <<= 1);
+
+    free(cl->bucket);
 
-    // copy contacts to new contactlist
-    for (i = 0; i < _cnf->cl.cl_size; i++)
+    if ((cl->bucket = malloc(buckets * sizeof(int))) == NULL)
     {
-        if (old_contact_list[i].fd)
+        ui_fatal("Reallocation of contact index failed!");
+    }
+
+    memset(cl->bucket, 0xff, buckets * sizeof(int));
+    cl->buckets = buckets;
+
+    for (i = 0; i < cl->cl_size; i++)
+    {
+        if (CONTACT(self, i)->fd && CONTACT(self, i)->lport)
         {
-            memcpy(new_contact_list + j, old_contact_list + i, sizeof(contact_t));
-            j++;
+            index_contact(self, i);
         }
     }
 
-    // set new size and point to new contactlist in the global config
-    _cnf->cl.cl_size = newsize;
-    _cnf->cl.contact = new_contact_list;
-    // free old contactlist
-    free(old_contact_list);
     return 0;
 }
 
 
 /**
- *  Adds a new contact to the local contactlist.
+ *  Adds a new contact to the contactlist of a worker.
  *  The given socket descriptor of the remote client will be used to add a new contact
- *  to the contactlist holded by the global config.
- *  @param fd  Socket file descriptor of the new contact
+ *  to the contactlist of the worker and is registered at its poller. The contact
+ *  is stored in the first slot of the free-list.
+ *  @param self Worker owning the contactlist
+ *  @param fd   Socket file descriptor of the new contact
  *  @return index of contact list, where new contact has been added or -1 in case
  *          of error
  */
 int
-add_contact(int fd)
+add_contact(worker_t* self, int fd)
 {
-    int i;
+    contact_t* contact; // slot of new contact
+    int n;
 
-    // if contactlist is full - resize it so that we can store more contacts in it
-    if (_cnf->cl.used_contacts == _cnf->cl.cl_size)
+    // if contactlist is full - grow it so that we can store more contacts in it
+    if (self->cl.used_contacts == self->cl.cl_size &&
+        grow_contactlist(self) < 0)
     {
-        if ((realloc_contactlist(_cnf->cl.cl_size + INIT_CONTACTS)) < 0)
-        {
-            return -1;
-        }
+        return -1;
     }
 
-    // search for an empty place to store the new contact
-    for (i = 0; i < _cnf->cl.cl_size; i++)
+    n = self->cl.free_slot;
+    contact = CONTACT(self, n);
+    contact->fd = fd;
+
+    // register socket at poller of worker
+    if (watch_contact(self, contact, EPOLL_CTL_ADD) == -1)
     {
-        // if fd is 0 -> this place can be used to store a new contact
-        if (!_cnf->cl.contact[i].fd)
-        {
-            _cnf->cl.contact[i].fd = fd;
-            _cnf->cl.used_contacts++; // increase contact counter
-            break;
-        }
+        contact->fd = 0;
+        return -1;
     }
 
+    self->cl.free_slot = contact->next;
+    contact->next = -1;
+    contact->slot = n;
+    self->cl.used_contacts++; // increase contact counter
+    // pending events of a former contact in this slot are stale
+    self->cl.gen++;
     // return index where contact has been stored
-    return i;
+    return n;
 }
 
 
 /**
- *  Deletes a contact from the local contactlist.
- *  Deletes a contact from the contact list holded by the global config.
- *  @param n   Index of customer in the customer list
+ *  Deletes a contact from the contactlist of a worker.
+ *  The slot of the contact is put on the free-list, other contacts are
+ *  not touched.
+ *  @param self Worker owning the contactlist
+ *  @param n    Index of customer in the customer list
  *  @return 0 on success, -1 if index is out of bounds
  */
 int
-del_contact(int n)
+del_contact(worker_t* self, int n)
 {
+    contact_t* contact; // contact to delete
+
     // is index 'n' a valid index?
-    if ((n < 0) || (n >= _cnf->cl.cl_size))
+    if ((n < 0) || (n >= self->cl.cl_size))
     {
         ui_log(LOG_ERR, "del_contact() - Index out of bounds '%d'", n);
         return -1;
     }
 
-    if (_cnf->cl.contact[n].fd == 0)
+    contact = CONTACT(self, n);
+
+    if (contact->fd == 0)
     {
         return 0;
     }
 
-    close(_cnf->cl.contact[n].fd);
-    // zero out the contact on index 'n'
-    memset(&_cnf->cl.contact[n], 0, sizeof(contact_t));
+    // unregister socket from poller
+    epoll_ctl(self->epfd, EPOLL_CTL_DEL, contact->fd, NULL);
+    close(contact->fd);
+    unindex_contact(self, n);
+    // free receive buffer and send queue of contact
+    free_reader(&contact->rd);
+    free_queue(self, &contact->oq);
+    // zero out the contact and put its slot on the free-list
+    memset(contact, 0, sizeof(contact_t));
+    contact->next = self->cl.free_slot;
+    self->cl.free_slot = n;
     // decrease contacts counter variable
-    _cnf->cl.used_contacts--;
+    self->cl.used_contacts--;
+    self->dir_dirty = 1;
+    return 0;
+}
+
+
+/**
+ *  Checks if two contacts have the same identity.
+ *  Contacts are identified by their onion address and listening port.
+ *  Temporary contacts, which have not sent a "control/discover" yet, do
+ *  not match any contact.
+ *  @param a Pointer to first contact
+ *  @param b Pointer to second contact
+ *  @return 1 if both contacts are the same, 0 otherwise
+ */
+int
+same_contact(contact_t* a, contact_t* b)
+{
+    return a->lport && a->lport == b->lport &&
+           !strcmp(a->onion_id, b->onion_id);
+}
+
+
+/**
+ *  Computes the hash of an onion address and a listening port (FNV-1a).
+ *  @param onion_id Onion address
+ *  @param lport    Listening port
+ *  @return hash value
+ */
+unsigned
+hash_contact(char* onion_id, uint16_t lport)
+{
+    // low byte first, digests of peers depend on it
+    char port[2] = { lport & 0xff, lport >> 8 };
+
+    return fnv1a(fnv1a(FNV_BASIS, onion_id, strlen(onion_id)), port, 2);
+}
+
 
-    // if contacts counter has been decreased INIT_CONTACTS time, resize the contactlist to free
-    // unused memory
-    if ((_cnf->cl.used_contacts == (_cnf->cl.cl_size - INIT_CONTACTS)) &&
-        _cnf->cl.used_contacts != 0)
+/**
+ *  Adds the contact at index `n` to the hash index of the worker, so that
+ *  it can be found by its onion address and listening port. The identity
+ *  of the contact has to be set.
+ *  @param self Worker owning the contact
+ *  @param n    Index of the contact
+ */
+void
+index_contact(worker_t* self, int n)
+{
+    contact_t* contact = CONTACT(self, n);
+    int b = hash_contact(contact->onion_id, contact->lport) & (self->cl.buckets - 1);
+
+    contact->next = self->cl.bucket[b];
+    self->cl.bucket[b] = n;
+}
+
+
+/**
+ *  Removes the contact at index `n` from the hash index of the worker.
+ *  Contacts without identity are not indexed and ignored.
+ *  @param self Worker owning the contact
+ *  @param n    Index of the contact
+ */
+void
+unindex_contact(worker_t* self, int n)
+{
+    contact_t* contact = CONTACT(self, n);
+    int* link; // link pointing to the contact
+
+    if (!contact->lport)
+    {
+        return;
+    }
+
+    link = &self->cl.bucket[hash_contact(contact->onion_id, contact->lport) &
+                            (self->cl.buckets - 1)];
+
+    for (; *link != -1; link = &CONTACT(self, *link)->next)
     {
-        if ((realloc_contactlist(_cnf->cl.cl_size - INIT_CONTACTS)) < 0)
+        if (*link == n)
         {
-            return -1;
+            *link = contact->next;
+            return;
         }
     }
-
-    return 0;
 }
 
+
 /**
- *  Searches a contact in the local contactlist.
- *  Searches for a contact in the contactlist holded within the global config
- *  and returns its index in the contactlist. To find a contact, its onion address
- *  and listening port will be used and compared with each other.
+ *  Searches a contact in the contactlist of a worker.
+ *  Only the hash bucket of the contact is searched, the contactlist itself
+ *  is not iterated. Only the worker itself may search its contactlist.
+ *  @param wk      Worker whose contactlist is searched
  *  @param contact Pointer to contact to search for
- *  @param begin   Index where the search will begin in the contactlist
- *  @return index of contact, -1 if the contact represents ourself, -2 if not found
+ *  @param prev    Index of a previous match to continue the search after,
+ *                 -1 to start a new search
+ *  @return index of contact, -1 if not found
  */
 int
-find_contact(contact_t* contact, int begin)
+find_contact(worker_t* wk, contact_t* contact, int prev)
 {
     int i;
-    contact_t* c;
 
-    // is begin a valid index?
-    if (begin < 0 || begin >= _cnf->cl.cl_size)
+    if (!wk->cl.buckets || !contact->lport)
     {
-        return -2;
+        return -1;
     }
 
-    // iterate through contactlist, but first check
-    // if the contact represents ourself
-    for (i = -1; i < _cnf->cl.cl_size; i++)
+    i = prev == -1 ?
+        wk->cl.bucket[hash_contact(contact->onion_id, contact->lport) &
+                      (wk->cl.buckets - 1)] :
+        CONTACT(wk, prev)->next;
+
+    for (; i != -1; i = CONTACT(wk, i)->next)
     {
-        // first check if the given contact matches ourself
-        if (i == -1)
+        if (same_contact(contact, CONTACT(wk, i)))
         {
-            c = &_cnf->me;
-            i = begin - 1;
+            return i;
         }
-        else
+    }
+
+    return -1; // not found
+}
+
+
+/**
+ *  Searches a contact in the contactlists of all workers.
+ *  The contactlist of the calling worker is searched directly, those of
+ *  other workers are searched in their published directories. No lock is
+ *  taken.
+ *  @param self    Worker of the calling thread or NULL
+ *  @param contact Pointer to contact to search for
+ *  @param except  Contact of the calling worker which is skipped or NULL
+ *  @param found   A copy of the found contact is stored here, may be NULL
+ *  @return worker owning the found contact, NULL if not found
+ */
+worker_t*
+locate_contact(worker_t* self, contact_t* contact, contact_t* except,
+               dir_entry_t* found)
+{
+    directory_t* dir; // published contacts of another worker
+    worker_t* wk;
+    int w, n;
+
+    for (w = 0; w < _cnf->workers; w++)
+    {
+        wk = &_cnf->wk[w];
+
+        if (wk == self)
         {
-            c = &_cnf->cl.contact[i];
+            for (n = find_contact(wk, contact, -1);
+                 n != -1 && CONTACT(wk, n) == except;
+                 n = find_contact(wk, contact, n));
+
+            if (n != -1)
+            {
+                if (found != NULL)
+                {
+                    fill_entry(found, CONTACT(wk, n));
+                }
+
+                return wk;
+            }
+
+            continue;
         }
 
-        // dont check empty contacts or temporary contacts
-        if (c->lport)
+        enter_directory(self);
+        dir = get_directory(wk);
+
+        if ((n = find_entry(dir, contact)) != -1)
         {
-            if (strcmp(contact_to_string(contact), contact_to_string(c)) == 0)
+            if (found != NULL)
             {
-                return i;
+                memcpy(found, &dir->entry[n], sizeof(*found));
             }
+
+            leave_directory(self);
+            return wk;
+        }
+
+        leave_directory(self);
+    }
+
+    return NULL;
+}
+
+
+/**
+ *  Copies the published fields of a contact into a directory entry.
+ *  @param entry   Directory entry to fill
+ *  @param contact Contact to publish
+ */
+void
+fill_entry(dir_entry_t* entry, contact_t* contact)
+{
+    entry->fd = contact->fd;
+    memcpy(entry->onion_id, contact->onion_id, sizeof(entry->onion_id));
+    entry->lport = contact->lport;
+    memcpy(entry->name, contact->name, sizeof(entry->name));
+    entry->accepted = contact->accepted;
+    entry->slot = contact->slot;
+    entry->next = -1;
+}
+
+
+/**
+ *  Searches a contact in a directory using its hash index.
+ *  @param dir     Directory to search, may be NULL
+ *  @param contact Pointer to contact to search for
+ *  @return index of directory entry, -1 if not found
+ */
+int
+find_entry(directory_t* dir, contact_t* contact)
+{
+    int i;
+
+    if (dir == NULL || !contact->lport)
+    {
+        return -1;
+    }
+
+    i = dir->bucket[hash_contact(contact->onion_id, contact->lport) &
+                    (dir->buckets - 1)];
+
+    for (; i != -1; i = dir->entry[i].next)
+    {
+        if (dir->entry[i].lport == contact->lport &&
+            !strcmp(dir->entry[i].onion_id, contact->onion_id))
+        {
+            return i;
+        }
+    }
+
+    return -1; // not found
+}
+
+
+/**
+ *  Returns the reader record of the calling thread. Workers own a record,
+ *  all other readers run in the main loop and share the global one.
+ *  @param self Worker of the calling thread or NULL
+ *  @return reader record
+ */
+reader_t*
+get_reader(worker_t* self)
+{
+    return self != NULL ? &self->rcu : &_cnf->rcu;
+}
+
+
+/**
+ *  Enters a read-side critical section of the directories.
+ *  Directories which are loaded afterwards are not freed until
+ *  leave_directory() has been called. Sections may be nested.
+ *  @param self Worker of the calling thread or NULL
+ */
+void
+enter_directory(worker_t* self)
+{
+    reader_t* rd = get_reader(self);
+
+    if (!rd->depth++)
+    {
+        // announce the epoch before any directory is loaded
+        __atomic_store_n(&rd->active, __atomic_load_n(&_cnf->epoch, __ATOMIC_SEQ_CST),
+                         __ATOMIC_SEQ_CST);
+    }
+}
+
+
+/**
+ *  Leaves a read-side critical section of the directories.
+ *  @param self Worker of the calling thread or NULL
+ */
+void
+leave_directory(worker_t* self)
+{
+    reader_t* rd = get_reader(self);
+
+    if (!--rd->depth)
+    {
+        __atomic_store_n(&rd->active, 0, __ATOMIC_RELEASE);
+    }
+}
+
+
+/**
+ *  Returns the currently published directory of a worker. The caller has
+ *  to be within a read-side critical section.
+ *  @param wk Worker whose directory is returned
+ *  @return directory or NULL if the worker has not published one yet
+ */
+directory_t*
+get_directory(worker_t* wk)
+{
+    return __atomic_load_n(&wk->dir, __ATOMIC_ACQUIRE);
+}
+
+
+/**
+ *  Publishes a new directory of the contacts of a worker.
+ *  A snapshot including a hash index is built from the contactlist and
+ *  replaces the current directory. The old directory is retired and freed
+ *  as soon as no reader can reference it anymore. Readers never wait for
+ *  this function and vice versa.
+ *  @param self Worker publishing its contacts
+ */
+void
+publish_directory(worker_t* self)
+{
+    directory_t* dir;  // new directory
+    directory_t* old;  // replaced directory
+    contact_t* contact;
+    int buckets = 1;   // buckets of hash index
+    int b, i;
+
+    // hash index has at least as many buckets as entries
+    for (; buckets < self->cl.used_contacts; buckets <<= 1);
+
+    // directory, its entries and hash index are one block
+    if ((dir = malloc(sizeof(*dir) + self->cl.used_contacts * sizeof(dir_entry_t) +
+                      buckets * sizeof(int))) == NULL)
+    {
+        ui_fatal("Memory allocation for contact directory failed!");
+    }
+
+    dir->cnt = 0;
+    dir->buckets = buckets;
+    dir->entry = (dir_entry_t*) (dir + 1);
+    dir->bucket = (int*) (dir->entry + self->cl.used_contacts);
+    memset(dir->bucket, 0xff, buckets * sizeof(int));
+
+    for (i = 0; i < self->cl.cl_size; i++)
+    {
+        contact = CONTACT(self, i);
+
+        if (!contact->fd)
+        {
+            continue;
         }
+
+        fill_entry(&dir->entry[dir->cnt], contact);
+
+        // temporary contacts can not be searched for
+        if (contact->lport)
+        {
+            b = hash_contact(contact->onion_id, contact->lport) & (buckets - 1);
+            dir->entry[dir->cnt].next = dir->bucket[b];
+            dir->bucket[b] = dir->cnt;
+        }
+
+        dir->cnt++;
     }
 
-    return -2; // not found
+    self->dir_dirty = 0;
+    old = __atomic_exchange_n(&self->dir, dir, __ATOMIC_SEQ_CST);
+
+    if (old != NULL)
+    {
+        // readers announcing an older epoch may still reference it
+        old->retired = __atomic_add_fetch(&_cnf->epoch, 1, __ATOMIC_SEQ_CST);
+        old->next = self->retired;
+        self->retired = old;
+    }
+
+    reclaim_directories(self);
+}
+
+
+/**
+ *  Publishes the directory of a worker if its contacts changed since the
+ *  last publication. Changes are collected while a batch of events is
+ *  handled, thus the directory is copied once per batch.
+ *  @see publish_directory()
+ *  @param self Worker publishing its contacts
+ */
+void
+sync_directory(worker_t* self)
+{
+    if (self->dir_dirty)
+    {
+        publish_directory(self);
+    }
+}
+
+
+/**
+ *  Frees retired directories of a worker, which can not be referenced by
+ *  any reader anymore. A reader which announced epoch `e` may reference
+ *  directories retired in an epoch later than `e`.
+ *  @param self Worker whose retired directories are freed
+ */
+void
+reclaim_directories(worker_t* self)
+{
+    unsigned long oldest = ULONG_MAX; // oldest epoch announced by a reader
+    unsigned long e;
+    directory_t** link;
+    directory_t* dir;
+    int w;
+
+    for (w = 0; w <= _cnf->workers; w++)
+    {
+        e = __atomic_load_n(w < _cnf->workers ? &_cnf->wk[w].rcu.active :
+                            &_cnf->rcu.active, __ATOMIC_SEQ_CST);
+
+        if (e && e < oldest)
+        {
+            oldest = e;
+        }
+    }
+
+    for (link = &self->retired; (dir = *link) != NULL;)
+    {
+        if (dir->retired <= oldest)
+        {
+            *link = dir->next;
+            free(dir);
+        }
+        else
+        {
+            link = &dir->next;
+        }
+    }
 }
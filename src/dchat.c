@@ -46,7 +46,8 @@
 #include <errno.h>
 #include <netinet/in.h>
 #include <pthread.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <signal.h>
 #include <unistd.h>
@@ -188,16 +189,16 @@ main(int argc, char** argv)
         usage(EXIT_FAILURE, &options, "Invalid command-line arguments!");
     }
 
-    // create listening socket
-    if (init_listening(LISTEN_ADDR) == -1)
+    // low watermark must not exceed high watermark
+    if (_cnf->qlow > _cnf->qhigh)
     {
-        ui_fatal("Initialization of listening socket failed!");
+        usage(EXIT_FAILURE, &options, "Low watermark exceeds high watermark!");
     }
 
-    if (_cnf->cl.used_contacts == 1)
+    // create listening socket
+    if (init_listening(LISTEN_ADDR) == -1)
     {
-        remote_onion = _cnf->cl.contact[0].onion_id;
-        rport = _cnf->cl.contact[0].lport;
+        ui_fatal("Initialization of listening socket failed!");
     }
 
     // init threads (connection thread, userinput thread, ...)
@@ -206,15 +207,14 @@ main(int argc, char** argv)
         ui_fatal("Initialization of threads failed!");
     }
 
-    // has a remote onion address or remote port been specified? (check
-    // fake contact - see: roni_parse() / rprt_parse()) if y: connect to
-    // it
-    if (_cnf->cl.used_contacts == 1)
+    // has a remote onion address or remote port been specified? (see:
+    // roni_parse() / rprt_parse()) if y: connect to it
+    if (_cnf->remote.onion_id[0] != '\0' || _cnf->remote.lport)
     {
         // use default if onion-id has not been specified
-        if (is_valid_onion(_cnf->cl.contact[0].onion_id))
+        if (is_valid_onion(_cnf->remote.onion_id))
         {
-            remote_onion = _cnf->cl.contact[0].onion_id;
+            remote_onion = _cnf->remote.onion_id;
         }
         else
         {
@@ -222,25 +222,21 @@ main(int argc, char** argv)
         }
 
         // use default if remote port has not been specified
-        if (is_valid_port(_cnf->cl.contact[0].lport))
+        if (is_valid_port(_cnf->remote.lport))
         {
-            rport = _cnf->cl.contact[0].lport;
+            rport = _cnf->remote.lport;
         }
         else
         {
             rport = DEFAULT_PORT;
         }
 
-        // delete fake contact
-        del_contact(0);
         // inform connection handler to connect to the specified
         // remote host
-        if(write(_cnf->connect_fd[1], remote_onion, ONION_ADDRLEN) == -1){
-             ui_log_errno(LOG_WARN, "Remote onion id could not be written");
-	}
-        if(write(_cnf->connect_fd[1], &rport,       sizeof(uint16_t)) == -1){
-             ui_log_errno(LOG_WARN, "Remote port could not be written");
-	}
+        if (request_connection(&_cnf->connect_rq, remote_onion, rport) == -1)
+        {
+            ui_log_errno(LOG_WARN, "Remote host could not be passed to the connector");
+        }
     }
 
     if (init_ui() == -1)
@@ -265,8 +261,15 @@ int
 init_global_config()
 {
     memset(_cnf, 0, sizeof(*_cnf));
-    _cnf->cl.cl_size       = 0;    // set initial size of contactlist
-    _cnf->cl.used_contacts = 0;    // no known contacts, at start
+    _cnf->workers          = 1;    // one event loop thread per default
+    _cnf->qhigh            = QUEUE_HIGH;
+    _cnf->qlow             = QUEUE_LOW;
+    _cnf->qtimeout         = QUEUE_TIMEOUT;
+    _cnf->connects         = CONNECTS;
+    _cnf->ctimeout         = CONN_TIMEOUT;
+    _cnf->bwindow          = BATCH_WINDOW;
+    _cnf->bmax             = BATCH_MAX;
+    _cnf->epoch            = 1;    // epoch 0 marks idle readers
     return 0;
 }
 
@@ -355,6 +358,7 @@ int
 init_threads()
 {
     struct sigaction sa_terminate; // signal action for program termination
+    int efd;                       // eventfd of user input
     sigset_t sigmask;
     sigemptyset(&sigmask);
     sigaddset(&sigmask, SIGHUP);
@@ -372,34 +376,57 @@ init_threads()
     sigaction(SIGINT,  &sa_terminate, NULL); // interrupt programm
     sigaction(SIGTERM, &sa_terminate, NULL); // software termination
 
-    // pipe to the th_new_conn
-    if (pipe(_cnf->connect_fd) == -1)
+    // connection requests to the th_new_conn
+    if ((_cnf->connect_efd = eventfd(0, EFD_NONBLOCK)) == -1 ||
+        init_ring(&_cnf->connect_rq, ONION_ADDRLEN + sizeof(uint16_t), CONNECT_RING,
+                  _cnf->connect_efd) == -1)
     {
-        ui_log_errno(LOG_ERR, "Creation of connection pipe failed!");
+        ui_log_errno(LOG_ERR, "Creation of connection ring failed!");
         return -1;
     }
 
-    // pipe to send signal to wait loop from connect
-    if (pipe(_cnf->cl_change) == -1)
+    if (init_connector(&_cnf->cn) == -1)
     {
-        ui_log_errno(LOG_ERR, "Creation of change pipe failed!");
         return -1;
     }
 
-    // pipe to signal new user input from stdin
-    if (pipe(_cnf->user_input) == -1)
+    // lines entered by the user
+    if ((efd = eventfd(0, EFD_NONBLOCK)) == -1 ||
+        init_ring(&_cnf->user_input, sizeof(char*), INPUT_RING, efd) == -1)
     {
-        ui_log_errno(LOG_ERR, "Creation of userinput pipe faild!");
+        ui_log_errno(LOG_ERR, "Creation of userinput ring failed!");
         return -1;
     }
 
-    // init the mutex function used for locking the contactlist
-    if (pthread_mutex_init(&_cnf->cl.cl_mx, NULL))
+    // epoll instance of main loop
+    if ((_cnf->epfd = epoll_create1(0)) == -1)
     {
-        ui_log_errno(LOG_ERR, "Initialization of mutex failed!");
+        ui_log_errno(LOG_ERR, "Creation of epoll instance failed!");
+        return -1;
+    }
+
+    // watch listening socket and user input pipe of main loop
+    if (watch_fd(_cnf->epfd, _cnf->user_input.efd, &_cnf->user_input) == -1 ||
+        watch_fd(_cnf->epfd, _cnf->acpt_fd, &_cnf->acpt_fd) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Registration at epoll instance failed!");
         return -1;
     }
 
+    if ((_cnf->wk = calloc(_cnf->workers, sizeof(worker_t))) == NULL)
+    {
+        ui_fatal("Memory allocation for workers failed!");
+    }
+
+    // create event loop threads, each owning a slice of the contacts
+    for (int i = 0; i < _cnf->workers; i++)
+    {
+        if (init_worker(&_cnf->wk[i]) == -1)
+        {
+            return -1;
+        }
+    }
+
     // create new th_new_conn-thread
     if (pthread_create
         (&_cnf->conn_th, NULL, (void* (*)(void*)) th_new_conn, _cnf) == -1)
@@ -430,6 +457,7 @@ init_threads()
 void
 destroy()
 {
+    char* line; // unhandled user input
     // cancel select thread
     pthread_cancel(_cnf->select_th);
     // wait for termination of select thread
@@ -439,13 +467,27 @@ destroy()
     // cancel connection thread
     // wait for termination of connection thread
     pthread_join(_cnf->conn_th, NULL);
-    // wait for termination of select thread
-    // destroy contact mutex
-    pthread_mutex_destroy(&_cnf->cl.cl_mx);
-    // close write pipe for thread function th_new_conn
-    close(_cnf->connect_fd[1]);
-    // close write pipe for thread function th_new_input
-    close(_cnf->user_input[1]);
+
+    // cancel event loop threads and wait for their termination
+    for (int i = 0; i < _cnf->workers && _cnf->wk != NULL; i++)
+    {
+        if (_cnf->wk[i].th)
+        {
+            pthread_cancel(_cnf->wk[i].th);
+            pthread_join(_cnf->wk[i].th, NULL);
+        }
+    }
+
+    // free the rings of the main loop and the connector, all their
+    // consumers have been terminated
+    while (ring_pop(&_cnf->user_input, &line))
+    {
+        free(line);
+    }
+
+    free_ring(&_cnf->user_input);
+    free_ring(&_cnf->connect_rq);
+
     // delete readline prompt and return to beginning of current line
     local_log(LOG_INFO, "Good Bye!");
 }
@@ -475,77 +517,169 @@ terminate(int sig)
  * Interpretes the given line and reacts correspondently to it. If the
  * line is a command it will be executed, otherwise it will be treated as
  * text message and send to all known contacts stored in the contactlist
- * in the global configuration.
- * @see write_pdu()
+ * in the global configuration. Text messages are collected for `bwindow`
+ * milliseconds and sent together, pending messages are sent before a
+ * command is executed.
+ * @see flush_batch()
  * @return 0 on success, -1 on error
  */
 int
 handle_local_input(char* line)
 {
-    dchat_pdu_t msg; // pdu containing the chat text message
-    int i, ret = 0, len;
+    batch_t* batch = &_cnf->batch; // pending text messages
+    int ret = 0;
 
     // check if user entered command
+    if (line[0] == '/' && flush_batch() == -1)
+    {
+        return -1;
+    }
+
     if ((ret = parse_cmd(line)) == 0 || ret == 1)
     {
         return 0;
     }
+
     // no command has been entered / or command could not be processed
-    else
+    if (line[0] == '\0')
+    {
+        return 0;
+    }
+
+    if (batch->pdu == NULL &&
+        (batch->pdu = malloc(_cnf->bmax * sizeof(*batch->pdu))) == NULL)
     {
-        ret = 0;
-        len = strlen(line); // memory for text message
+        ui_fatal("Memory allocation for text messages failed!");
+    }
 
-        if (len != 0)
-        {
-            // inititialize pdu
-            if (init_dchat_pdu(&msg, CTT_ID_TXT, 1.0, _cnf->me.onion_id, _cnf->me.lport,
-                               _cnf->me.name) == -1)
-            {
-                ui_log(LOG_ERR, "Initialization of PDU failed!");
-                return -1;
-            }
+    // inititialize pdu
+    if (init_dchat_pdu(&batch->pdu[batch->cnt], 1.0, CTT_ID_TXT, _cnf->me.onion_id,
+                       _cnf->me.lport, _cnf->me.name) == -1)
+    {
+        ui_log(LOG_ERR, "Initialization of PDU failed!");
+        return -1;
+    }
 
-            // set content of pdu
-            init_dchat_pdu_content(&msg, line, strlen(line));
+    // set content of pdu
+    init_dchat_pdu_content(&batch->pdu[batch->cnt], line, strlen(line));
+
+    // the window starts with the first message of a batch
+    if (!batch->cnt++)
+    {
+        batch->deadline = mono_msec() + _cnf->bwindow;
+    }
+
+    if (batch->cnt == _cnf->bmax || !_cnf->bwindow)
+    {
+        return flush_batch();
+    }
+
+    return 0;
+}
 
-            // write pdu to known contacts
-            for (i = 0; i < _cnf->cl.cl_size; i++)
-            {
-                if (_cnf->cl.contact[i].fd)
-                {
-                    ret = write_pdu(_cnf->cl.contact[i].fd, &msg);
-                }
-            }
 
-            free_pdu(&msg);
+/**
+ * Sends the pending text messages of the user.
+ * All messages are encoded once and passed to the workers at once.
+ * @see broadcast_pdus()
+ * @return 0 on success, -1 on error
+ */
+int
+flush_batch()
+{
+    batch_t* batch = &_cnf->batch; // pending text messages
+    int ret = 0;
+
+    if (batch->cnt)
+    {
+        ret = broadcast_pdus(batch->pdu, batch->cnt);
+
+        for (int i = 0; i < batch->cnt; i++)
+        {
+            free_pdu(&batch->pdu[i]);
         }
+
+        batch->cnt = 0;
     }
 
-    // return value of write_pdu
     return ret != -1 ? 0 : -1;
 }
 
 
+/**
+ * Milliseconds until the pending text messages have to be sent.
+ * @return timeout for epoll_wait(2), -1 if no messages are pending
+ */
+int
+batch_timeout()
+{
+    unsigned long now = mono_msec();
+
+    if (!_cnf->batch.cnt)
+    {
+        return -1;
+    }
+
+    return _cnf->batch.deadline > now ? _cnf->batch.deadline - now : 0;
+}
+
+
 /**
  * Handles PDUs received from a remote client.
- * Reads in a PDU from a certain contact file descriptor and interpretes its
- * headers and handles its content.
- * @param n Index of contact in the respective contactlist
- * @return length of bytes read, 0 on EOF or -1 in case of error
+ * Receives data from a certain contact file descriptor and handles every
+ * PDU that has been completed by it. Parts of a PDU which are not complete
+ * yet are kept in the receive buffer of the contact, so that this function
+ * never waits for the remaining data.
+ * @see read_pdu()
+ * @see handle_remote_pdu()
+ * @param self Worker owning the contact
+ * @param n    Index of contact in the contactlist of the worker
+ * @return length of bytes read, 0 on EOF, PDU_AGAIN if no PDU has been
+ * completed or -1 in case of error
  */
 int
-handle_remote_input(int n)
+handle_remote_input(worker_t* self, int n)
 {
     dchat_pdu_t pdu;    // pdu read from contact file descriptor
-    char* txt_msg;      // message used to store remote input
     int ret;            // return value
-    int len;            // amount of bytes read
-    contact_t* contact; // contact to send a message to
-    contact = &_cnf->cl.contact[n];
+    int len;            // amount of bytes of a pdu
+    int total = 0;      // amount of bytes read in total
+    int fd;             // file descriptor of contact
+    contact_t* contact; // contact who sent the data
+    contact = CONTACT(self, n);
+    fd = contact->fd;
+
+    // receive data and read first pdu (-1 indicates error)
+    len = read_pdu(fd, &contact->rd, &pdu);
+
+    while (len > 0)
+    {
+        // update receive statistics
+        __sync_add_and_fetch(&_cnf->st.rx_pdus, 1);
+        __sync_add_and_fetch(&_cnf->st.rx_bytes, len);
+        __sync_add_and_fetch(&_cnf->st.rx_syscalls, contact->rd.syscalls);
+        contact->rd.syscalls = 0;
+        total += len;
+        ret = handle_remote_pdu(self, n, &pdu);
+        free_pdu(&pdu);
+
+        if (ret == -1)
+        {
+            return -1;
+        }
+
+        // contact may have been removed as duplicate
+        if (CONTACT(self, n)->fd != fd)
+        {
+            return total;
+        }
+
+        // parse next pdu from the receive buffer
+        contact = CONTACT(self, n);
+        len = next_pdu(&contact->rd, &pdu);
+    }
 
-    // read pdu from file descriptor (-1 indicates error)
-    if ((len = read_pdu(contact->fd, &pdu)) == -1)
+    if (len == -1)
     {
         ui_log(LOG_ERR, "Illegal PDU from '%s'!", contact->name);
         return -1;
@@ -557,95 +691,130 @@ handle_remote_input(int n)
         return 0;
     }
 
+    return total ? total : PDU_AGAIN;
+}
+
+
+/**
+ * Handles a single PDU received from a remote client.
+ * Interpretes the headers of the PDU and handles its content.
+ * @param self Worker owning the contact
+ * @param n    Index of contact in the contactlist of the worker
+ * @param pdu  Pointer to the received PDU
+ * @return 0 on success or -1 if the contact should be removed
+ */
+int
+handle_remote_pdu(worker_t* self, int n, dchat_pdu_t* pdu)
+{
+    char* txt_msg;      // message used to store remote input
+    int ret;            // return value
+    int dup;            // index of duplicate contact
+    contact_t* contact; // contact who sent the pdu
+    contact = CONTACT(self, n);
+
     // the first pdus of a newly connected client have to be a
     // "control/discover" containing the onion-id and listening
     // port, otherwise raise an error and delete
     // this contact
     if ((contact->onion_id[0] == '\0' || !contact->lport)  &&
-        pdu.content_type != CTT_ID_DSC)
+        pdu->content_type != CTT_ID_DSC && pdu->content_type != CTT_ID_CTL)
     {
         ui_log(LOG_ERR, "Client '%d' omitted identification!", n);
         return -1;
     }
 
-    // check mandatory headers received
-    if (contact->name[0] != '\0' && strcmp(contact->name, pdu.nickname) != 0)
-    {
-        ui_log(LOG_INFO, "'%s' changed nickname to '%s'!", contact->name,
-               pdu.nickname);
-    }
-
-    if (contact->onion_id[0] != '\0' &&
-        strcmp(contact->onion_id, pdu.onion_id) != 0)
-    {
-        ui_log(LOG_ERR, "'%s' changed Onion-ID! Contact will be removed!",
-               contact->name);
-        return -1;
-    }
-
-    if (contact->lport != 0 && contact->lport != pdu.lport)
+    // pdus in session mode refer to the identity the contact already has
+    if (!pdu->interned && update_identity(self, n, pdu) == -1)
     {
-        ui_log(LOG_ERR, "'%s' changed Listening Port! Contact will be removed!",
-               contact->name);
         return -1;
     }
 
-    // set nickname of contact
-    contact->name[0] = '\0';
-
-    if (pdu.nickname[0] != '\0')
+    // the first pdu tells the capabilities of the contact, contacts
+    // without support of digests get our whole contactlist, the others
+    // exchange digests first (see CONTROL/DIGEST)
+    if (!(contact->caps & CAP_KNOWN))
     {
-        strncat(contact->name, pdu.nickname, MAX_NICKNAME);
-    }
+        contact->caps = parse_capabilities(pdu->server) | CAP_KNOWN;
 
-    // set onion id of contact
-    contact->onion_id[0] = '\0';
-
-    if (pdu.onion_id[0] != '\0')
-    {
-        strncat(contact->onion_id, pdu.onion_id, ONION_ADDRLEN);
+        if (!(contact->caps & CAP_DIGEST))
+        {
+            send_contacts(self, n, NULL, 0);
+        }
+        else if (contact->accepted)
+        {
+            send_digest(self, n);
+        }
     }
 
-    // set listening port of contact
-    contact->lport = pdu.lport;
-
     /*
      * == TEXT/PLAIN ==
      */
-    if (pdu.content_type == CTT_ID_TXT)
+    if (pdu->content_type == CTT_ID_TXT)
     {
         // allocate memory for text message
-        if ((txt_msg = malloc(pdu.content_length + 1)) == NULL)
+        if ((txt_msg = malloc(pdu->content_length + 1)) == NULL)
         {
             ui_fatal("Memory allocation for text message failed!");
         }
 
         // store bytes from pdu in txt_msg and terminate it
-        memcpy(txt_msg, pdu.content, pdu.content_length);
-        txt_msg[pdu.content_length] = '\0';
+        memcpy(txt_msg, pdu->content, pdu->content_length);
+        txt_msg[pdu->content_length] = '\0';
         // print text message
-        ui_write(pdu.nickname, txt_msg);
+        ui_write(pdu->nickname, txt_msg);
         free(txt_msg);
     }
     /*
-     * == CONTROL/DISCOVER ==
+     * == APPLICATION/OCTET ==
      */
-    else if (pdu.content_type == CTT_ID_DSC)
+    else if (pdu->content_type == CTT_ID_BIN)
     {
-        // since dchat brings with the problem of duplicate contacts
-        // check if there are duplicate contacts in the contactlist
-        if ((ret = check_duplicates(n)) != -1) //error
+        // large content has already been passed to consume_octet()
+        if (!pdu->streamed)
         {
-            ui_log(LOG_INFO, "Detected duplicate contact - removing it!");
-            del_contact(ret);  // delete duplicate
+            pdu->checksum = fnv1a(FNV_BASIS, pdu->content, pdu->content_length);
         }
 
+        ui_log(LOG_INFO, "'%s' sent %d bytes of binary data (checksum %08x)%s!",
+               pdu->nickname, pdu->content_length, pdu->checksum,
+               pdu->streamed ? " (streamed)" : "");
+    }
+    /*
+     * == CONTROL/DISCOVER, CONTROL/CONTACTS ==
+     */
+    else if (pdu->content_type == CTT_ID_DSC || pdu->content_type == CTT_ID_CTL)
+    {
+        // since dchat brings with the problem of duplicate contacts
+        // check if there are duplicate contacts in the contactlist
+        // a duplicate owned by another worker is removed by message
+        dup = check_duplicates(self, n);
+
         // iterate through the content of the pdu containing
         // the new contacts
-        if ((ret = receive_contacts(&pdu)) == -1)
+        if ((ret = receive_contacts(self, pdu)) == -1)
         {
             ui_log(LOG_WARN, "Could not add all contacts from the received contactlist!");
         }
+
+        if (dup != -1)
+        {
+            ui_log(LOG_INFO, "Detected duplicate contact - removing it!");
+            return -1;
+        }
+    }
+    /*
+     * == CONTROL/DIGEST ==
+     */
+    else if (pdu->content_type == CTT_ID_DGT)
+    {
+        // send contacts missing in the digest, the contact we connected
+        // to gets our digest in return
+        send_contacts(self, n, (unsigned char*) pdu->content, pdu->content_length);
+
+        if (!contact->accepted)
+        {
+            send_digest(self, n);
+        }
     }
     /*
      * == UNKNOWN CONTENT-TYPE ==
@@ -655,174 +824,763 @@ handle_remote_input(int n)
         ui_log(LOG_WARN, "Unknown Content-Type!");
     }
 
-    free_pdu(&pdu);
-    return len;
+    return 0;
+}
+
+
+/**
+ * Consumes a chunk of streamed "application/octet" content.
+ * Content of at least STREAM_MIN bytes is passed to this function as it is
+ * received instead of being buffered. There is no use for binary data in
+ * this client yet, thus only its checksum is kept, which is reported once
+ * the content is complete.
+ * @see begin_content()
+ * @param pdu   Pointer to the PDU whose headers have been received, its
+ *              `streamed` field tells how many bytes have been consumed
+ * @param chunk Next chunk of the content
+ * @param len   Length of chunk
+ * @return 0 on success, -1 if the content should be refused
+ */
+int
+consume_octet(dchat_pdu_t* pdu, char* chunk, int len)
+{
+    if (pdu->streamed == 0)
+    {
+        ui_log(LOG_INFO, "Receiving %d bytes of binary data from '%s'...",
+               pdu->content_length, pdu->nickname);
+    }
+
+    pdu->checksum = fnv1a(pdu->streamed ? pdu->checksum : FNV_BASIS, chunk, len);
+    return 0;
 }
 
 
 /**
- * Handles local connection requests from the user.
- * Connects to the remote client with the given onion address, who will
- * be added as contact. This new contact will be sent that all of our known
- * contacts as specified in the DChat protocol.
- * @param onion_id Destination onion address to connect to
- * @param port     Destination port to connect to
- * @return The index where the contact has been added in the contactlist,
- * -1 on error
+ * Updates the identity of a contact with the headers of a received PDU.
+ * Onion-ID and listening port must not change once they are known, a
+ * changed nickname is taken over. PDUs in session mode omit the identity
+ * and are not checked at all.
+ * @param self Worker owning the contact
+ * @param n    Index of contact in the contactlist of the worker
+ * @param pdu  Pointer to the received PDU
+ * @return 0 on success or -1 if the contact should be removed
  */
 int
-handle_local_conn_request(char* onion_id, uint16_t port)
+update_identity(worker_t* self, int n, dchat_pdu_t* pdu)
 {
-    int s; // socket of the contact we have connected to
-    int n; // index of the contact in our contactlist
+    int changed;        // identity of contact changed?
+    contact_t* contact; // contact who sent the pdu
+    contact = CONTACT(self, n);
+
+    // check mandatory headers received
+    if (contact->name[0] != '\0' && strcmp(contact->name, pdu->nickname) != 0)
+    {
+        ui_log(LOG_INFO, "'%s' changed nickname to '%s'!", contact->name,
+               pdu->nickname);
+    }
 
-    // connect to given address
-    if ((s = create_tor_socket(onion_id, port)) == -1)
+    if (contact->onion_id[0] != '\0' &&
+        strcmp(contact->onion_id, pdu->onion_id) != 0)
     {
+        ui_log(LOG_ERR, "'%s' changed Onion-ID! Contact will be removed!",
+               contact->name);
         return -1;
     }
-    else
+
+    if (contact->lport != 0 && contact->lport != pdu->lport)
     {
-        // add contact
-        if ((n = add_contact(s)) == -1)
-        {
-            ui_log_errno(LOG_ERR, "Could not add new contact!");
-            return -1;
-        }
-        else
-        {
-            // set onion id of new contact
-            _cnf->cl.contact[n].onion_id[0] = '\0';
-            strncat(_cnf->cl.contact[n].onion_id, onion_id, ONION_ADDRLEN);
-            // set listening port of new contact
-            _cnf->cl.contact[n].lport = port;
-            // send all our known contacts to the newly connected client
-            send_contacts(n);
-        }
+        ui_log(LOG_ERR, "'%s' changed Listening Port! Contact will be removed!",
+               contact->name);
+        return -1;
+    }
+
+    // identity is published to other threads only if it changed
+    changed = !contact->lport || strncmp(contact->name, pdu->nickname, MAX_NICKNAME);
+    // set nickname of contact
+    contact->name[0] = '\0';
+
+    if (pdu->nickname[0] != '\0')
+    {
+        strncat(contact->name, pdu->nickname, MAX_NICKNAME);
+    }
+
+    // set onion id of contact
+    contact->onion_id[0] = '\0';
+
+    if (pdu->onion_id[0] != '\0')
+    {
+        strncat(contact->onion_id, pdu->onion_id, ONION_ADDRLEN);
+    }
+
+    // set listening port of contact and make it findable
+    if (!contact->lport && pdu->lport)
+    {
+        contact->lport = pdu->lport;
+        index_contact(self, n);
+    }
+
+    if (changed)
+    {
+        self->dir_dirty = 1;
     }
 
-    return n;
+    return 0;
+}
+
+
+/**
+ * Handles local connection requests which have been established.
+ * Hands the connection to the remote client, which has been set up by
+ * the connector, to a worker, who will add it as contact. This new contact
+ * will be sent all of our known contacts as specified in the DChat protocol,
+ * or those it does not know if it supports digests.
+ * @see handle_worker_msg()
+ * @param att Connection attempt whose SOCKS request has been granted
+ * @return 0 on success, -1 on error
+ */
+int
+handle_local_conn_request(conn_attempt_t* att)
+{
+    worker_msg_t msg; // message passing the connection to a worker
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = MSG_ADD;
+    msg.fd = att->fd;
+    msg.lport = att->lport;
+    memcpy(msg.onion_id, att->onion_id, ONION_ADDRLEN);
+
+    // socket has been created in non-blocking mode by the connector
+    post_msg(pick_worker(), &msg);
+    return 0;
 }
 
 
 /**
  * Handles connection requests from a remote client.
  * Accepts a connection from a remote client and so that a new chat session
- * will be established between this and the remote host. Moreover the remote
- * host will be added as new contact in the contactlist and the local contactlist
- * will be sent to him.
- * @see add_contact()
- * @return return value of function add_contact, or -1 on error
+ * will be established between this and the remote host. The connection is
+ * handed to a worker, who will add the remote host as new contact. The
+ * local contactlist is sent as soon as the remote host has identified.
+ * @see handle_worker_msg()
+ * @return 0 on success, -1 on error
  */
 int
 handle_remote_conn_request()
 {
-    int s;                      // socket file descriptor
-    int n;                      // index of new contact
+    worker_msg_t msg; // message passing the connection to a worker
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = MSG_ADD;
+    msg.accepted = 1;
 
     // accept connection request
-    if ((s = accept(_cnf->acpt_fd, NULL, NULL)) == -1)
+    if ((msg.fd = accept(_cnf->acpt_fd, NULL, NULL)) == -1)
     {
         ui_log_errno(LOG_ERR, "Could not accept connection from remote host!");
         return -1;
     }
 
-    // add new contact to contactlist
-    if ((n = add_contact(s)) != -1)
-    {
-        ui_log(LOG_INFO, "Remote host (%d) connected!", n);
-    }
-    else
+    // a slow contact must not block the event loop
+    if (set_nonblocking(msg.fd) == -1)
     {
-        ui_log_errno(LOG_ERR, "Could not add new contact!");
+        ui_log_errno(LOG_ERR, "Could not set contact socket to non-blocking mode!");
+        close(msg.fd);
         return -1;
     }
 
-    _cnf->cl.contact[n].accepted = 1;
-    send_contacts(n);
-    return n;
+    post_msg(pick_worker(), &msg);
+    return 0;
 }
 
 
 /**
- * Cleanup ressources used by the thread `conn_th` holded by the
- * global config.
- * Closes the reading pipe `connect_fd` and the writing pipe end
- * of `cl_change` stored in the global config.
+ * Handles a message passed to a worker.
+ * New connections are added as contact, contacts we connected to are
+ * announced our identity. Wire buffers are queued for all contacts of the
+ * worker and duplicates detected by other workers are deleted.
+ * @param self Worker who received the message
+ * @param msg  Pointer to the message
  */
 void
-cleanup_th_new_conn(void* arg)
-{
-    /// close pipes used for in `th_new_conn`
-    close(_cnf->connect_fd[0]);
-    close(_cnf->cl_change[1]);
-}
-
-
-/**
- * Thread function that reads an onion address from a pipe and connects to this
- * address.
- * Establishes new connections to the given addresses read from the global config
- * pipe `connect_fd`. It reads an onion address and then connects to
- * this address via TOR. If a connection has been established successfully, a new
- * contact will be added and the contactlist will be sent to him. Furthermore
- * the character '1' will be written to the global config pipe `cl_change`.
- * @see handle_local_conn_request()
- */
-void*
-th_new_conn()
+handle_worker_msg(worker_t* self, worker_msg_t* msg)
 {
-    char onion_id[ONION_ADDRLEN + 1]; // onion address of remote host
-    uint16_t port;                    // port of remote host
-    char c = '1';                     // signal that a new connection has been established
-    int ret;
-    // setup cleanup handler and cancelation attributes
-    pthread_cleanup_push(cleanup_th_new_conn, NULL);
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+    contact_t* contact; // contact of the message
+    contact_t key;      // identity of contact to delete
+    int n;
 
-    for (;;)
+    switch (msg->type)
     {
-        // read from pipe to get new address
-        if ((ret = read(_cnf->connect_fd[0], onion_id, ONION_ADDRLEN)) == -1)
-        {
-            ui_log(LOG_WARN, "Could not read Onion-ID from connection pipe!");
-        }
+        case MSG_ADD:
+            if ((n = add_contact(self, msg->fd)) == -1)
+            {
+                ui_log_errno(LOG_ERR, "Could not add new contact!");
+                close(msg->fd);
+                break;
+            }
 
-        // EOF
-        if (!ret)
-        {
-            break;
-        }
+            contact = CONTACT(self, n);
+            contact->accepted = msg->accepted;
+            // set onion id and listening port of contact we connected to
+            memcpy(contact->onion_id, msg->onion_id, ONION_ADDRLEN);
+            contact->lport = msg->lport;
 
-        // read from pipe to get new port
-        if ((ret = read(_cnf->connect_fd[0], &port, sizeof(uint16_t))) == -1)
-        {
-            ui_log(LOG_WARN, "Could not read Listening-Port from connection pipe!");
-        }
+            if (contact->lport)
+            {
+                index_contact(self, n);
+            }
+
+            self->dir_dirty = 1;
+
+            if (msg->accepted)
+            {
+                ui_log(LOG_INFO, "Remote host (%d) connected!", n);
+            }
+
+            // contactlists are exchanged as soon as the contact told its
+            // capabilities, the contact we connected to waits for us
+            if (!msg->accepted)
+            {
+                send_announce(self, n);
+            }
+
+            break;
+
+        case MSG_SEND:
+            deliver_wire_buf(self, msg);
+            release_msg(msg);
+            break;
+
+        case MSG_DEL:
+            memset(&key, 0, sizeof(key));
+            memcpy(key.onion_id, msg->onion_id, ONION_ADDRLEN);
+            key.lport = msg->lport;
+
+            // several contacts may share the identity, the socket tells
+            for (n = find_contact(self, &key, -1);
+                 n != -1 && CONTACT(self, n)->fd != msg->fd;
+                 n = find_contact(self, &key, n));
+
+            if (n != -1)
+            {
+                ui_log(LOG_INFO, "Detected duplicate contact - removing it!");
+                del_contact(self, n);
+            }
 
-        // EOF
-        if (!ret)
-        {
             break;
+    }
+}
+
+
+/**
+ * Passes a message to a worker.
+ * @see post_msgs()
+ * @param wk  Worker who receives the message
+ * @param msg Pointer to the message
+ */
+void
+post_msg(worker_t* wk, worker_msg_t* msg)
+{
+    post_msgs(wk, msg, 1);
+}
+
+
+/**
+ * Passes several messages to a worker at once.
+ * The messages are copied and appended to the inbox of the worker, which
+ * is woken up by its inbox eventfd(2). Since the worker takes all of
+ * them at once, wire buffers of several MSG_SEND messages are written by
+ * a single writev(2).
+ * @param wk  Worker who receives the messages
+ * @param msg Array of messages
+ * @param cnt Amount of messages
+ */
+void
+post_msgs(worker_t* wk, worker_msg_t* msg, int cnt)
+{
+    worker_msg_t* head = NULL; // copied messages
+    worker_msg_t* tail = NULL; // last copied message
+    worker_msg_t* copy;
+
+    for (int i = 0; i < cnt; i++)
+    {
+        if ((copy = malloc(sizeof(*copy))) == NULL)
+        {
+            ui_fatal("Memory allocation for worker message failed!");
+        }
+
+        memcpy(copy, &msg[i], sizeof(*copy));
+        copy->next = NULL;
+
+        if (tail != NULL)
+        {
+            tail->next = copy;
+        }
+        else
+        {
+            head = copy;
+        }
+
+        tail = copy;
+    }
+
+    pthread_mutex_lock(&wk->msg_mx);
+
+    if (wk->msg_tail != NULL)
+    {
+        wk->msg_tail->next = head;
+    }
+    else
+    {
+        wk->msg_head = head;
+    }
+
+    wk->msg_tail = tail;
+    pthread_mutex_unlock(&wk->msg_mx);
+
+    if (ring_notify(wk->inbox) == -1)
+    {
+        ui_log_errno(LOG_WARN, "Could not write to inbox of worker!");
+    }
+}
+
+
+/**
+ * Selects the worker for a new connection.
+ * Connections are distributed round robin.
+ * @return pointer to the worker
+ */
+worker_t*
+pick_worker()
+{
+    return &_cnf->wk[__sync_fetch_and_add(&_cnf->next_wk, 1) % _cnf->workers];
+}
+
+
+/**
+ * Passes a connection request to the connector thread.
+ * Every thread requesting connections owns a ring buffer to the
+ * connector: the main loop uses `connect_rq` of the global config, a
+ * worker its own one. All of them share the eventfd(2) of the connector.
+ * @see th_new_conn()
+ * @param rq       Ring buffer of the calling thread
+ * @param onion_id Onion address to connect to
+ * @param port     Port to connect to
+ * @return 0 on success, -1 on error
+ */
+int
+request_connection(ring_t* rq, char* onion_id, uint16_t port)
+{
+    char req[ONION_ADDRLEN + sizeof(uint16_t)]; // onion address and port
+
+    memcpy(req, onion_id, ONION_ADDRLEN);
+    memcpy(req + ONION_ADDRLEN, &port, sizeof(uint16_t));
+
+    if (ring_push(rq, req) == -1)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return ring_notify(rq->efd);
+}
+
+
+/**
+ * Initializes the connector.
+ * Creates the epoll instance of the connector, which watches the eventfd(2)
+ * of the connection request rings and all sockets of connection attempts.
+ * @param cn Connector to initialize
+ * @return 0 on success, -1 in case of error
+ */
+int
+init_connector(connector_t* cn)
+{
+    if ((cn->epfd = epoll_create1(0)) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Creation of epoll instance failed!");
+        return -1;
+    }
+
+    if (watch_fd(cn->epfd, _cnf->connect_efd, &_cnf->connect_efd) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Registration at epoll instance failed!");
+        return -1;
+    }
+
+    if ((cn->att = calloc(_cnf->connects, sizeof(conn_attempt_t))) == NULL)
+    {
+        ui_fatal("Memory allocation for connection attempts failed!");
+    }
+
+    return 0;
+}
+
+
+/**
+ * Queues a connection request until a connection attempt is free.
+ * Requests for a host which is already waiting or in flight are
+ * ignored, since the contactlists of several contacts will usually
+ * name the same hosts.
+ * @param cn       Connector
+ * @param onion_id Onion address to connect to
+ * @param port     Port to connect to
+ */
+void
+queue_conn_request(connector_t* cn, char* onion_id, uint16_t port)
+{
+    conn_req_t* req;  // waiting request
+    conn_req_t* pend; // grown ring
+    int i;
+
+    for (i = 0; i < _cnf->connects; i++)
+    {
+        if (cn->att[i].state != CONN_FREE && cn->att[i].lport == port &&
+            !strcmp(cn->att[i].onion_id, onion_id))
+        {
+            return;
+        }
+    }
+
+    for (i = 0; i < cn->pend_cnt; i++)
+    {
+        req = &cn->pend[(cn->pend_head + i) % cn->pend_size];
+
+        if (req->lport == port && !strcmp(req->onion_id, onion_id))
+        {
+            return;
+        }
+    }
+
+    // grow ring and unwrap its elements
+    if (cn->pend_cnt == cn->pend_size)
+    {
+        if ((pend = malloc((cn->pend_size + INIT_QUEUE) * sizeof(conn_req_t))) == NULL)
+        {
+            ui_fatal("Memory allocation for connection requests failed!");
         }
 
-        // terminate address
+        for (i = 0; i < cn->pend_cnt; i++)
+        {
+            pend[i] = cn->pend[(cn->pend_head + i) % cn->pend_size];
+        }
+
+        free(cn->pend);
+        cn->pend = pend;
+        cn->pend_size += INIT_QUEUE;
+        cn->pend_head = 0;
+    }
+
+    req = &cn->pend[(cn->pend_head + cn->pend_cnt) % cn->pend_size];
+    memset(req, 0, sizeof(*req));
+    strncat(req->onion_id, onion_id, ONION_ADDRLEN);
+    req->lport = port;
+    cn->pend_cnt++;
+}
+
+
+/**
+ * Queues all connection requests of a connection request ring.
+ * @see request_connection()
+ * @param cn Connector
+ * @param rq Ring buffer of a thread requesting connections
+ */
+void
+take_conn_requests(connector_t* cn, ring_t* rq)
+{
+    char req[ONION_ADDRLEN + sizeof(uint16_t)]; // onion address and port
+    char onion_id[ONION_ADDRLEN + 1];           // onion address of remote host
+    uint16_t port;                              // port of remote host
+
+    while (ring_pop(rq, req))
+    {
+        memcpy(onion_id, req, ONION_ADDRLEN);
         onion_id[ONION_ADDRLEN] = '\0';
-        // lock contactlist
-        pthread_mutex_lock(&_cnf->cl.cl_mx);
+        memcpy(&port, req + ONION_ADDRLEN, sizeof(uint16_t));
+        queue_conn_request(cn, onion_id, port);
+    }
+}
+
+
+/**
+ * Starts connection attempts for waiting requests until the concurrency
+ * limit has been reached.
+ * @param cn Connector
+ */
+void
+start_conn_attempts(connector_t* cn)
+{
+    struct epoll_event ev; // events of the TOR socket
+    conn_attempt_t* att;   // free connection attempt
+    conn_req_t* req;       // first waiting request
+    int i = 0;
+
+    while (cn->pend_cnt && cn->active < _cnf->connects)
+    {
+        req = &cn->pend[cn->pend_head];
+        cn->pend_head = (cn->pend_head + 1) % cn->pend_size;
+        cn->pend_cnt--;
 
-        if (handle_local_conn_request(onion_id, port) == -1)
+        for (; cn->att[i].state != CONN_FREE; i++);
+
+        att = &cn->att[i];
+        memset(att, 0, sizeof(*att));
+        memcpy(att->onion_id, req->onion_id, ONION_ADDRLEN);
+        att->lport = req->lport;
+
+        if ((att->fd = connect_tor_async()) == -1)
         {
-            ui_log(LOG_WARN, "Connection to remote host failed!");
+            ui_log(LOG_WARN, "Connection to '%s' failed!", att->onion_id);
+            continue;
         }
-        else if ((write(_cnf->cl_change[1], &c, sizeof(c))) == -1)
+
+        // connection is established as soon as the socket is writable
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLOUT;
+        ev.data.ptr = att;
+
+        if (epoll_ctl(cn->epfd, EPOLL_CTL_ADD, att->fd, &ev) == -1)
         {
-            ui_log(LOG_WARN, "Could not write to change pipe!");
+            ui_log_errno(LOG_ERR, "Registration at epoll instance failed!");
+            close(att->fd);
+            continue;
         }
 
-        // unlock contactlist
-        pthread_mutex_unlock(&_cnf->cl.cl_mx);
+        att->state = CONN_TCP;
+        att->started = mono_msec();
+        att->deadline = att->started + _cnf->ctimeout * 1000UL;
+        cn->active++;
+    }
+}
+
+
+/**
+ * Frees a connection attempt. If it has failed, its socket is closed,
+ * otherwise the connection is handed to a worker. The duration of
+ * granted handshakes is accounted to the runtime statistics.
+ * @param cn     Connector
+ * @param att    Connection attempt to free
+ * @param reason Reason why the attempt failed or NULL on success
+ */
+void
+finish_conn_attempt(connector_t* cn, conn_attempt_t* att, char* reason)
+{
+    unsigned long msec = mono_msec() - att->started; // handshake duration
+
+    epoll_ctl(cn->epfd, EPOLL_CTL_DEL, att->fd, NULL);
+
+    if (reason != NULL)
+    {
+        ui_log(LOG_WARN, "Connection to '%s' failed: %s", att->onion_id, reason);
+        close(att->fd);
+        __atomic_add_fetch(&_cnf->st.socks_failed, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        handle_local_conn_request(att);
+        __atomic_add_fetch(&_cnf->st.socks_ok, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&_cnf->st.socks_msec, msec, __ATOMIC_RELAXED);
+
+        // the connector is the only writer of the maximum
+        if (msec > __atomic_load_n(&_cnf->st.socks_max, __ATOMIC_RELAXED))
+        {
+            __atomic_store_n(&_cnf->st.socks_max, msec, __ATOMIC_RELAXED);
+        }
+    }
+
+    att->state = CONN_FREE;
+    cn->active--;
+}
+
+
+/**
+ * Advances a connection attempt whose socket is ready.
+ * Once the TOR client has been connected the SOCKS request is sent, which
+ * is answered as soon as the curcuit to the remote host has been set up.
+ * Errors and hang ups reported by epoll(7) fail the attempt.
+ * @param cn     Connector
+ * @param att    Connection attempt
+ * @param events Events reported by epoll(7)
+ */
+void
+handle_conn_event(connector_t* cn, conn_attempt_t* att, uint32_t events)
+{
+    struct epoll_event ev; // events of the TOR socket
+    socklen_t len = sizeof(int);
+    int err = 0;
+    int ret;
+
+    if (att->state == CONN_TCP)
+    {
+        // a hang up while connecting means that the TOR client refused it
+        if ((events & (EPOLLERR | EPOLLHUP)) ||
+            getsockopt(att->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err)
+        {
+            finish_conn_attempt(cn, att, "TOR client not reachable");
+            return;
+        }
+
+        if (write_socks4a(att->fd, att->onion_id, att->lport) == -1)
+        {
+            finish_conn_attempt(cn, att, "Could not write SOCKS request");
+            return;
+        }
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = att;
+        epoll_ctl(cn->epfd, EPOLL_CTL_MOD, att->fd, &ev);
+        att->state = CONN_SOCKS;
+        return;
+    }
+
+    // reply may arrive in pieces
+    if ((ret = read_socks4a(att->fd, &att->reply)) == -1)
+    {
+        finish_conn_attempt(cn, att, errno == ECONNRESET ?
+                            "Connection to TOR client has been closed" :
+                            "Could not read SOCKS reply");
+        return;
+    }
+
+    if (!ret)
+    {
+        // no more data will complete the reply
+        if (events & (EPOLLERR | EPOLLHUP))
+        {
+            finish_conn_attempt(cn, att, "Connection to TOR client has been closed");
+        }
+
+        return;
+    }
+
+    if (att->reply.status != SOCKS_GRANTED)
+    {
+        finish_conn_attempt(cn, att, parse_socks_status(att->reply.status));
+        return;
+    }
+
+    finish_conn_attempt(cn, att, NULL);
+}
+
+
+/**
+ * Gives up connection attempts which exceeded their deadline.
+ * @param cn Connector
+ * @return milliseconds until the next deadline or -1 if no attempt is in flight
+ */
+int
+expire_conn_attempts(connector_t* cn)
+{
+    unsigned long now = mono_msec();
+    unsigned long next = 0; // next deadline
+    int i;
+
+    for (i = 0; i < _cnf->connects; i++)
+    {
+        if (cn->att[i].state == CONN_FREE)
+        {
+            continue;
+        }
+
+        if (cn->att[i].deadline <= now)
+        {
+            finish_conn_attempt(cn, &cn->att[i], "Timeout");
+        }
+        else if (!next || cn->att[i].deadline < next)
+        {
+            next = cn->att[i].deadline;
+        }
+    }
+
+    return next ? (int) (next - now) : -1;
+}
+
+
+/**
+ * Cleanup ressources used by the thread `conn_th` holded by the
+ * global config.
+ * Closes the eventfd(2) `connect_efd` stored in the global config and
+ * all sockets of connection attempts in flight.
+ */
+void
+cleanup_th_new_conn(void* arg)
+{
+    connector_t* cn = &_cnf->cn;
+
+    for (int i = 0; i < _cnf->connects && cn->att != NULL; i++)
+    {
+        if (cn->att[i].state != CONN_FREE)
+        {
+            close(cn->att[i].fd);
+        }
+    }
+
+    free(cn->att);
+    free(cn->pend);
+    close(cn->epfd);
+    close(_cnf->connect_efd);
+}
+
+
+/**
+ * Thread function that takes onion addresses from the connection request
+ * rings and connects to these addresses.
+ * Establishes new connections to the given addresses passed by
+ * request_connection(). Up to `connects` SOCKS handshakes are kept in
+ * flight at once, further requests wait until an attempt finishes. Every
+ * attempt is given up after `ctimeout` seconds. Established connections
+ * are handed to a worker.
+ * @see handle_local_conn_request()
+ */
+void*
+th_new_conn()
+{
+    struct epoll_event ev[MAX_EVENTS]; // ready file descriptors
+    connector_t* cn = &_cnf->cn;
+    int timeout = -1;   // milliseconds until next deadline
+    int nfds;           // number of ready file descriptors
+    int i;
+    // setup cleanup handler and cancelation attributes
+    pthread_cleanup_push(cleanup_th_new_conn, NULL);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+
+    for (;;)
+    {
+        if ((nfds = epoll_wait(cn->epfd, ev, MAX_EVENTS, timeout)) == -1)
+        {
+            // something interrupted epoll_wait(2) - try again
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            ui_log_errno(LOG_ERR, "epoll_wait() failed!");
+            break;
+        }
+
+        for (i = 0; i < nfds; i++)
+        {
+            // CHECK RINGS: queue new connection requests
+            if (ev[i].data.ptr == &_cnf->connect_efd)
+            {
+                ring_drain(_cnf->connect_efd);
+                take_conn_requests(cn, &_cnf->connect_rq);
+
+                for (int w = 0; w < _cnf->workers; w++)
+                {
+                    take_conn_requests(cn, &_cnf->wk[w].connect_rq);
+                }
+
+                continue;
+            }
+
+            // CHECK ATTEMPTS: advance SOCKS handshake
+            handle_conn_event(cn, ev[i].data.ptr, ev[i].events);
+        }
+
+        start_conn_attempts(cn);
+        timeout = expire_conn_attempts(cn);
     }
 
     // execute cleanup handler
@@ -833,10 +1591,10 @@ th_new_conn()
 
 /**
  * Thread function that reads from stdin until the user hits enter.
- * Waits for new user input. If the user has entered something,
- * it will be written to the global config pipe `user_input`.
- * First the length (int) of the string will be written to the pipe and then each
- * byte of the string. On EOF of stdin 0 will be written
+ * Waits for new user input. If the user has entered something, the
+ * line is pushed to the global config ring `user_input` and the main
+ * loop takes over its memory. If the ring is full, the user input is
+ * delayed until the main loop has caught up.
  * @return 0 on success, -1 in case of error
  */
 int
@@ -865,6 +1623,7 @@ th_new_input()
         // EOF or user has entered "/exit"
         if (line == NULL || !strcmp(line, "/exit"))
         {
+            free(line);
             break;
         }
         else
@@ -872,34 +1631,18 @@ th_new_input()
             // user did not write anything -> just hit enter
             if (len == 0)
             {
-                len = 1;
-
-                if (write(_cnf->user_input[1], &len, sizeof(int)) == -1)
-                {
-                    return -1;
-                }
-
-                if (write(_cnf->user_input[1], "\n", len) == -1)
-                {
-                    return -1;
-                }
+                strcpy(line, "\n");
             }
-            else
-            {
-                // first write length of string
-                if (write(_cnf->user_input[1], &len, sizeof(int)) == -1)
-                {
-                    return -1;
-                }
 
-                // then write the bytes of the string
-                if (write(_cnf->user_input[1], line, len) == -1)
-                {
-                    return -1;
-                }
+            while (ring_push(&_cnf->user_input, &line) == -1)
+            {
+                usleep(1000);
             }
 
-            free(line);
+            if (ring_notify(_cnf->user_input.efd) == -1)
+            {
+                return -1;
+            }
         }
     }
 
@@ -910,197 +1653,330 @@ th_new_input()
 /**
  * Cleanup ressources used by the thread `select_th` holded by the
  * global config.
- * Closes the listening port, every contact file descriptor and
- * the reading pipe end of `user_input` and `cl_change`.
+ * Closes the listening port, the eventfd(2) of `user_input` and
+ * the epoll instance.
  */
 void
 cleanup_th_main_loop(void* arg)
 {
-    int i;
     // close local listening socket
     close(_cnf->acpt_fd);
+    //close eventfd of user input
+    close(_cnf->user_input.efd);
+    close(_cnf->epfd);
+}
 
-    // close file descriptors of contacts
-    for (i = 0; i < _cnf->cl.cl_size; i++)
-    {
-        if (_cnf->cl.contact[i].fd)
-        {
-            close(_cnf->cl.contact[i].fd);
-        }
-    }
 
-    //close pipe stdin
-    close(_cnf->user_input[0]);
-    // close write pipe for main thread function th_main_loop
-    close(_cnf->cl_change[0]);
+/**
+ * Registers a file descriptor at an epoll(7) instance.
+ * @param epfd epoll(7) instance
+ * @param fd   File descriptor that will be watched for readability
+ * @param ptr  Event data which identifies the file descriptor
+ * @return 0 on success, -1 on error
+ */
+int
+watch_fd(int epfd, int fd, void* ptr)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = ptr;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
 }
 
 
 /**
  * Main chat loop of this client.
- * This function is the main loop of DChat that selects(2) certain file
- * descriptors stored in the global configuration to read from.
- * It waits for local userinput, PDUs from remote clients, local connection
- * requests and remote connection requests. If select returns and a  file
- * descriptor can be read, this function will take action depending on which file
- * descriptor is able to read from.
+ * This function waits with epoll(7) for local userinput and remote
+ * connection requests. Text messages are passed to all workers as soon as
+ * their batching window is over, accepted connections are handed to a
+ * worker. Contacts are handled by the workers.
+ * @see th_worker()
  */
 void*
 th_main_loop()
 {
-    fd_set rset;    // list of readable file descriptors
-    int nfds;       // number of fd in rset
-    int ret;        // return value
-    char c;         // for pipe: th_new_conn
-    char* line;     // line returned from user input
-    int cancel = 0; // cancel main loop
+    struct epoll_event ev[MAX_EVENTS]; // ready file descriptors
+    int nfds;           // number of ready file descriptors
+    int ret;            // return value
+    char* line;         // line taken from user input
+    int cancel = 0;     // cancel main loop
     int i;
     // setup cleanup handler and cancelation attributes
     pthread_cleanup_push(cleanup_th_main_loop, NULL);
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 
-    for (;;)
+    while (!cancel)
     {
-        // INIT fd_set
-        FD_ZERO(&rset);
-        // ADD STDIN: pipe file descriptor that connects the thread
-        // function 'th_new_input'
-        FD_SET(_cnf->user_input[0], &rset);
-        // ADD LISTENING PORT: acpt_fd of global config
-        FD_SET(_cnf->acpt_fd, &rset);
-        nfds = max(_cnf->user_input[0], _cnf->acpt_fd);
-        // ADD NEW CONN: pipe file descriptor that connects the thead
-        // function 'th_new_conn'
-        FD_SET(_cnf->cl_change[0], &rset);
-        nfds = max(nfds, _cnf->cl_change[0]);
-        // ADD CONTACTS: add all contact socket file descriptors from
-        // the contactlist
-        pthread_mutex_lock(&_cnf->cl.cl_mx);
-
-        for (i = 0; i < _cnf->cl.cl_size; i++)
+        pthread_testcancel();
+
+        while ((nfds = epoll_wait(_cnf->epfd, ev, MAX_EVENTS, batch_timeout())) == -1)
         {
-            if (_cnf->cl.contact[i].fd)
+            pthread_testcancel();
+
+            // something interrupted epoll_wait(2) - try again
+            if (errno == EINTR)
             {
-                FD_SET(_cnf->cl.contact[i].fd, &rset);
-                // determine fd with highest value
-                nfds = max(_cnf->cl.contact[i].fd, nfds);
+                continue;
             }
+
+            ui_log_errno(LOG_ERR, "epoll_wait() failed!");
+            cancel = 1;
+            break;
         }
 
-        pthread_mutex_unlock(&_cnf->cl.cl_mx);
-        // used as backup since nfds will be overwritten if an
-        // interrupt
-        // occurs
-        int old_nfds = nfds;
-        pthread_testcancel();
+        // batching window of pending text messages is over
+        if (!batch_timeout() && flush_batch() == -1)
+        {
+            cancel = 1;
+        }
 
-        while ((nfds = select(old_nfds + 1, &rset, NULL, NULL, NULL))  <= 0)
+        for (i = 0; i < nfds && !cancel; i++)
         {
-            pthread_testcancel();
+            // CHECK STDIN: check if thread has pushed lines to the
+            // user_input ring
+            if (ev[i].data.ptr == &_cnf->user_input)
+            {
+                ring_drain(_cnf->user_input.efd);
+
+                // handle user input
+                while (!cancel && ring_pop(&_cnf->user_input, &line))
+                {
+                    ret = handle_local_input(line);
+                    free(line);
 
-            if (nfds == -1)
+                    if (ret == -1)
+                    {
+                        cancel = 1;
+                    }
+                }
+            }
+            // CHECK LISTENING PORT: check if new connection can be
+            // accepted
+            else if (ev[i].data.ptr == &_cnf->acpt_fd)
             {
-                // something interrupted select(2) - try select again
-                if (errno == EINTR)
+                // handle new connection request
+                if (handle_remote_conn_request() == -1)
                 {
-                    continue;
+                    cancel = 1;
                 }
-
-                ui_log_errno(LOG_ERR, "select() failed!");
-                cancel = 1;
-                break;
             }
         }
+    }
 
-        if (cancel)
-        {
-            break;
-        }
+    //execute cleanup handler
+    pthread_cleanup_pop(1);
+    pthread_exit(NULL);
+}
+
+
+/**
+ * Initializes a worker and starts its event loop thread.
+ * @param wk Pointer to the worker
+ * @return 0 on success, -1 on error
+ */
+int
+init_worker(worker_t* wk)
+{
+    // epoll instance of worker
+    if ((wk->epfd = epoll_create1(0)) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Creation of epoll instance failed!");
+        return -1;
+    }
+
+    // eventfd to signal new messages
+    if ((wk->inbox = eventfd(0, EFD_NONBLOCK)) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Creation of inbox eventfd failed!");
+        return -1;
+    }
+
+    // connection requests of the worker to the connector
+    if (init_ring(&wk->connect_rq, ONION_ADDRLEN + sizeof(uint16_t), CONNECT_RING,
+                  _cnf->connect_efd) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Creation of connection ring failed!");
+        return -1;
+    }
+
+    if (watch_fd(wk->epfd, wk->inbox, &wk->inbox) == -1)
+    {
+        ui_log_errno(LOG_ERR, "Registration at epoll instance failed!");
+        return -1;
+    }
+
+    // init the mutex used for locking the inbox
+    if (pthread_mutex_init(&wk->msg_mx, NULL))
+    {
+        ui_log_errno(LOG_ERR, "Initialization of mutex failed!");
+        return -1;
+    }
+
+    if (pthread_create(&wk->th, NULL, (void* (*)(void*)) th_worker, wk))
+    {
+        ui_log_errno(LOG_ERR, "Creation of worker thread failed!");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Cleanup ressources used by a worker thread.
+ * Closes every contact file descriptor, the inbox eventfd(2) and the
+ * epoll instance of the worker and frees its connection request ring.
+ * @param arg Pointer to the worker
+ */
+void
+cleanup_th_worker(void* arg)
+{
+    worker_t* wk = arg;
+    int i;
 
-        // CHECK STDIN: check if thread has written to the user_input
-        // pipe
-        if (FD_ISSET(_cnf->user_input[0], &rset))
+    // close file descriptors of contacts
+    for (i = 0; i < wk->cl.cl_size; i++)
+    {
+        if (CONTACT(wk, i)->fd)
         {
-            nfds--;
+            close(CONTACT(wk, i)->fd);
+        }
+    }
 
-            // read length of string from pipe
-            if (read(_cnf->user_input[0], &ret, sizeof(int)) < 0)
-            {
-                break;
-            }
+    close(wk->inbox);
+    close(wk->epfd);
+    // the connector has already been joined, see destroy()
+    free_ring(&wk->connect_rq);
+}
 
-            // allocate memory for the string entered from user
-            line = malloc(ret + 1);
 
-            // read string
-            if (read(_cnf->user_input[0], line, ret) < 0 || ret <= 0)
-            {
-                free(line);
-                break;
-            }
+/**
+ * Event loop of a worker.
+ * Waits with epoll(7) for the contacts owned by the worker and for
+ * messages passed to it. Contacts are registered in add_contact() and
+ * their event data points to the contact itself, thus the costs of a
+ * wakeup only depend on the amount of ready file descriptors.
+ * @see handle_worker_msg()
+ * @param wk Pointer to the worker
+ */
+void*
+th_worker(worker_t* wk)
+{
+    struct epoll_event ev[MAX_EVENTS]; // ready file descriptors
+    worker_msg_t* msg;  // messages passed to the worker
+    worker_msg_t* next; // next message
+    contact_t* contact; // contact of a ready file descriptor
+    // last check of congested send queues, volatile since
+    // pthread_cleanup_push() may be implemented with setjmp(3)
+    volatile time_t checked = 0;
+    unsigned gen;       // generation of contactlist
+    int nfds;           // number of ready file descriptors
+    int ret;            // return value
+    int i, n;
+    // setup cleanup handler and cancelation attributes
+    pthread_cleanup_push(cleanup_th_worker, wk);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 
-            line[ret] = '\0';
-            pthread_mutex_lock(&_cnf->cl.cl_mx);
+    for (;;)
+    {
+        pthread_testcancel();
 
-            // handle user input
-            if ((ret = handle_local_input(line)) == -1)
+        // wake up periodically while send queues are congested
+        if ((nfds = epoll_wait(wk->epfd, ev, MAX_EVENTS,
+                               wk->cl.congested ? 1000 : -1)) == -1)
+        {
+            // something interrupted epoll_wait(2) - try again
+            if (errno == EINTR)
             {
-                break;
+                continue;
             }
 
-            pthread_mutex_unlock(&_cnf->cl.cl_mx);
-            free(line);
+            ui_log_errno(LOG_ERR, "epoll_wait() failed!");
+            break;
         }
 
-        // CHECK LISTENING PORT: check if new connection can be
-        // accepted
-        if (FD_ISSET(_cnf->acpt_fd, &rset))
-        {
-            nfds--;
-            pthread_mutex_lock(&_cnf->cl.cl_mx);
+        gen = wk->cl.gen;
 
-            // handle new connection request
-            if ((ret = handle_remote_conn_request()) == -1)
+        // stop if a slot has been reused, remaining events are
+        // reported again by the next epoll_wait(2)
+        for (i = 0; i < nfds && gen == wk->cl.gen; i++)
+        {
+            // CHECK INBOX: handle messages passed to the worker
+            if (ev[i].data.ptr == &wk->inbox)
             {
-                break;
+                ring_drain(wk->inbox);
+
+                pthread_mutex_lock(&wk->msg_mx);
+                msg = wk->msg_head;
+                wk->msg_head = wk->msg_tail = NULL;
+                pthread_mutex_unlock(&wk->msg_mx);
+
+                for (; msg != NULL; msg = next)
+                {
+                    next = msg->next;
+                    handle_worker_msg(wk, msg);
+                    free(msg);
+                }
+
+                // write the wire buffers queued by the messages at once
+                flush_contacts(wk);
+
+                continue;
             }
 
-            pthread_mutex_unlock(&_cnf->cl.cl_mx);
-        }
+            // CHECK CONTACTS: event data points to the contact
+            contact = ev[i].data.ptr;
+            n = contact->slot;
 
-        // CHECK NEW CONN: check if user new connection has been added
-        if (FD_ISSET(_cnf->cl_change[0], &rset))
-        {
-            nfds--;
+            // contact has been deleted in the meantime
+            if (!contact->fd)
+            {
+                continue;
+            }
 
-            // !< EOF
-            if (read(_cnf->cl_change[0], &c, sizeof(c)) < 0)
+            // CHECK WRITABLE: drain send queue of contact
+            if ((ev[i].events & (EPOLLOUT | EPOLLERR)) &&
+                flush_contact(wk, contact) == -1)
             {
-                break;
+                ui_log_errno(LOG_WARN, "Sending to contact '%s' failed!",
+                             contact->name);
+                del_contact(wk, n);
+                continue;
             }
-        }
 
-        // CHECK CONTACTS: check file descriptors of contacts
-        // check if nfds is 0 => no contacts have written something
-        pthread_mutex_lock(&_cnf->cl.cl_mx);
+            // handle input from remote user
+            // -1 = error, 0 = EOF
+            if ((ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+                ((ret = handle_remote_input(wk, n)) == -1 || ret == 0))
+            {
+                del_contact(wk, n);
+            }
+        }
 
-        for (i = 0; nfds && i < _cnf->cl.cl_size; i++)
+        // CHECK CONGESTION: disconnect contacts which do not
+        // receive their send queue in time
+        if (wk->cl.congested && checked != mono_time())
         {
-            if (FD_ISSET(_cnf->cl.contact[i].fd, &rset))
-            {
-                nfds--;
+            checked = mono_time();
 
-                // handle input from remote user
-                // -1 = error, 0 = EOF
-                if ((ret = handle_remote_input(i)) == -1 || ret == 0)
+            for (i = 0; i < wk->cl.cl_size; i++)
+            {
+                if (CONTACT(wk, i)->fd &&
+                    is_slow_contact(CONTACT(wk, i), checked))
                 {
-                    del_contact(i);
+                    ui_log(LOG_WARN, "Contact '%s' is too slow - disconnecting!",
+                           CONTACT(wk, i)->name);
+                    del_contact(wk, i);
                 }
             }
         }
 
-        pthread_mutex_unlock(&_cnf->cl.cl_mx);
+        // other threads see the changes of this batch at once
+        sync_directory(wk);
     }
 
     //execute cleanup handler
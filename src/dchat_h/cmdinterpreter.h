@@ -28,7 +28,7 @@
 //*********************************
 //          MISC
 //*********************************
-#define CMD_AMOUNT 3
+#define CMD_AMOUNT 4
 #define CMD_PREFIX "/"
 
 
@@ -38,6 +38,7 @@
 #define CMD_ID_HLP 0x01
 #define CMD_ID_CON 0x02
 #define CMD_ID_LST 0x03
+#define CMD_ID_STA 0x04
 
 
 //*********************************
@@ -46,6 +47,7 @@
 #define CMD_NAME_HLP CMD_PREFIX "help"
 #define CMD_NAME_CON CMD_PREFIX "connect"
 #define CMD_NAME_LST CMD_PREFIX "list"
+#define CMD_NAME_STA CMD_PREFIX "stats"
 
 
 //*********************************
@@ -54,6 +56,7 @@
 #define CMD_ARG_HLP ""
 #define CMD_ARG_CON CLI_OPT_ARG_RONI " " CLI_OPT_ARG_RPRT
 #define CMD_ARG_LST ""
+#define CMD_ARG_STA ""
 
 
 //*********************************
@@ -94,6 +97,7 @@ int parse_cmd(char* buf);
 int hlp_exec(char* arg);
 int con_exec(char* arg);
 int lst_exec(char* arg);
+int sta_exec(char* arg);
 
 
 //*********************************
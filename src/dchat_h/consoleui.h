@@ -3,11 +3,22 @@
 
 #include <syslog.h>
 #include <stdarg.h>
+#include <sys/uio.h>
 
 #include "types.h"
 #include "option.h"
 
 #define LOG_WARN LOG_WARNING
+#define UI_READ_CHUNK 4096
+#define UI_MAX_LINE   65536
+#define UI_QUEUE_MAX  4096
+#define UI_PENDING_MAX 65536
+#define UI_SPOOL_MAX  1024
+#define UI_OUT        0
+#define UI_LOG        1
+#define UI_MAX_CLIENTS 16
+#define UI_BACKLOG    8
+#define UI_FATAL_WAIT 100
 
 int init_ui();
 int ui_write(char* nickname, char* msg);
@@ -17,6 +28,9 @@ int ui_log_errno(int lf, const char* fmt, ...);
 void local_log_errno(int lf, const char* fmt, ...);
 void ui_fatal(char* fmt, ...);
 int vlog_msgf(int fd, int lf, const char* fmt, va_list ap, int with_errno);
+int format_log(char* buf, int size, int lf, const char* fmt, va_list ap, int with_errno);
+int vui_log(int lf, const char* fmt, va_list ap, int with_errno, int force);
+void ui_log_summary(int lf, const char* fmt, ...);
 
 void usage(int exit_status, cli_options_t* options, const char* fmt, ...);
 void print_usage(int fd, cli_options_t* options);
@@ -24,18 +38,66 @@ void print_usage(int fd, cli_options_t* options);
 typedef struct ipc
 {
     char* path;
-    int fd;
+    int fd;      //!< listening socket
 } ipc_t;
 
+/*!
+ * Line passed to the output thread.
+ */
+typedef struct ui_line
+{
+    struct ui_line* next; //!< next pending line
+    int type;             //!< UI_OUT or UI_LOG
+    int refs;             //!< subscribers which have not written it yet
+    int len;              //!< length of line
+    char buf[];           //!< formatted line including newline
+} ui_line_t;
 
-void ipc_connect();
+/*!
+ * Frontend subscribed to chat or log messages.
+ */
+typedef struct ui_client
+{
+    int fd;               //!< socket of subscriber
+    int type;             //!< UI_OUT or UI_LOG
+    ui_line_t** q;        //!< ring of lines to write, UI_QUEUE_MAX slots
+    int head;             //!< index of first line
+    int cnt;              //!< amount of lines
+    int off;              //!< bytes of first line written already
+    int armed;            //!< waiting for writability?
+    unsigned long dropped; //!< lines dropped since the queue was full
+} ui_client_t;
 
-void* th_ipc_reconnector(void* ptr);
+/*!
+ * Frontend passing user input.
+ */
+typedef struct line_reader
+{
+    int fd;      //!< socket of input client, -1 if disconnected
+    char* buf;   //!< data read but not returned as line yet
+    int len;     //!< amount of bytes in buffer
+    int size;    //!< size of buffer
+} line_reader_t;
 
-void signal_reconnect();
+int unix_listen(ipc_t* ipc);
 
-int ui_read_line(char** line);
+ui_line_t* new_ui_line(int type, const char* fmt, ...);
+int push_ui_line(ui_line_t* ln, int force);
+ui_line_t* take_ui_lines();
+int enqueue_ui_line(ui_client_t* cl, ui_line_t* ln);
+void release_ui_line(ui_line_t* ln);
+void spool_ui_line(ui_line_t* ln);
+void replay_ui_spool(ui_client_t* cl);
+void fan_out_ui_lines(ui_line_t* ln);
+void accept_ui_clients(int epfd, ipc_t* ipc, int type);
+void close_ui_client(ui_client_t* cl);
+int flush_ui_client(int epfd, ui_client_t* cl);
+void* th_ui_output(void* ptr);
 
-int read_line_sync(int fd, char** line);
+int ui_read_line(char** line);
+int cut_line(line_reader_t* rd, char** line);
+int fill_line_reader(line_reader_t* rd);
+void accept_input_clients();
+int read_line_sync(char** line);
 
 #endif
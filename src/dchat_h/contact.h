@@ -23,12 +23,53 @@
 
 #include "types.h"
 
+
+//*********************************
+//            MACROS
+//*********************************
+#define CONTACT(WK, N) (&(WK)->cl.chunk[(N) / INIT_CONTACTS][(N) % INIT_CONTACTS])
+
+
+//*********************************
+//        DIGEST SETTINGS
+//*********************************
+#define DIGEST_BITS    16  // bits per contact
+#define DIGEST_HASHES  8   // bits set per contact
+#define DIGEST_MIN     64  // minimum size in bytes
+
+
+//*********************************
+//     BINARY CONTACTLIST
+//*********************************
+#define CONTACT_BINLEN (ONION_BINLEN + 2) // decoded onion-id and port
+
 //*********************************
 //       DCHAT PROTO FUNCTIONS
 //*********************************
-int send_contacts(int n);
-int receive_contacts(dchat_pdu_t* pdu);
-int check_duplicates(int n);
+int send_contacts(worker_t* self, int n, unsigned char* digest, int len);
+int send_announce(worker_t* self, int n);
+int send_digest(worker_t* self, int n);
+unsigned digest_bit(char* onion_id, uint16_t lport, int i, unsigned bits);
+int in_digest(unsigned char* digest, int len, char* onion_id, uint16_t lport);
+int receive_contacts(worker_t* self, dchat_pdu_t* pdu);
+int learn_contact(worker_t* self, contact_t* contact);
+int check_duplicates(worker_t* self, int n);
+int broadcast_pdu(dchat_pdu_t* pdu);
+int broadcast_pdus(dchat_pdu_t* pdu, int cnt);
+void release_msg(worker_msg_t* msg);
+void deliver_wire_buf(worker_t* self, worker_msg_t* msg);
+wire_buf_t* pick_wire_buf(contact_t* contact, worker_msg_t* msg);
+void flush_contacts(worker_t* self);
+int send_pdu(worker_t* self, contact_t* contact, dchat_pdu_t* pdu);
+
+
+//*********************************
+//        QUEUE FUNCTIONS
+//*********************************
+int queue_wire_buf(worker_t* self, contact_t* contact, wire_buf_t* wb);
+int flush_contact(worker_t* self, contact_t* contact);
+int is_slow_contact(contact_t* contact, time_t now);
+void free_queue(worker_t* self, out_queue_t* oq);
 
 
 //*********************************
@@ -36,15 +77,37 @@ int check_duplicates(int n);
 //*********************************
 char* contact_to_string(contact_t* contact);
 int string_to_contact(contact_t* contact, char* string);
+int parse_contact(contact_t* contact, const char* line, int len);
 
 
 //*********************************
 //         MISC FUNCTIONS
 //*********************************
-int realloc_contactlist(int newsize);
-int add_contact(int fd);
-int del_contact(int n);
-int find_contact(contact_t* contact, int begin);
+int grow_contactlist(worker_t* self);
+int add_contact(worker_t* self, int fd);
+int del_contact(worker_t* self, int n);
+int same_contact(contact_t* a, contact_t* b);
+unsigned hash_contact(char* onion_id, uint16_t lport);
+void index_contact(worker_t* self, int n);
+void unindex_contact(worker_t* self, int n);
+int find_contact(worker_t* wk, contact_t* contact, int prev);
+worker_t* locate_contact(worker_t* self, contact_t* contact, contact_t* except,
+                         dir_entry_t* found);
+int watch_contact(worker_t* self, contact_t* contact, int op);
+
+
+//*********************************
+//      DIRECTORY FUNCTIONS
+//*********************************
+void fill_entry(dir_entry_t* entry, contact_t* contact);
+int find_entry(directory_t* dir, contact_t* contact);
+reader_t* get_reader(worker_t* self);
+void enter_directory(worker_t* self);
+void leave_directory(worker_t* self);
+directory_t* get_directory(worker_t* wk);
+void publish_directory(worker_t* self);
+void sync_directory(worker_t* self);
+void reclaim_directories(worker_t* self);
 
 
 #endif
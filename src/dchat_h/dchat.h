@@ -41,9 +41,12 @@
 int init_global_config();
 int init_listening(char* address);
 int init_threads();
+int watch_fd(int epfd, int fd, void* ptr);
+int init_worker(worker_t* wk);
 void destroy();
 void cleanup_th_new_conn(void* arg);
 void cleanup_th_main_loop(void* arg);
+void cleanup_th_worker(void* arg);
 
 
 //*********************************
@@ -51,9 +54,36 @@ void cleanup_th_main_loop(void* arg);
 //*********************************
 void terminate(int sig);
 int handle_local_input(char* line);
-int handle_remote_input(int n);
-int handle_local_conn_request(char* onion_id, uint16_t port);
+int flush_batch();
+int batch_timeout();
+int handle_remote_input(worker_t* self, int n);
+int handle_remote_pdu(worker_t* self, int n, dchat_pdu_t* pdu);
+int update_identity(worker_t* self, int n, dchat_pdu_t* pdu);
+int consume_octet(dchat_pdu_t* pdu, char* chunk, int len);
+int handle_local_conn_request(conn_attempt_t* att);
 int handle_remote_conn_request();
+void handle_worker_msg(worker_t* self, worker_msg_t* msg);
+
+
+//*********************************
+//      MESSAGE FUNCTIONS
+//*********************************
+void post_msg(worker_t* wk, worker_msg_t* msg);
+void post_msgs(worker_t* wk, worker_msg_t* msg, int cnt);
+worker_t* pick_worker();
+int request_connection(ring_t* rq, char* onion_id, uint16_t port);
+
+
+//*********************************
+//      CONNECTOR FUNCTIONS
+//*********************************
+int init_connector(connector_t* cn);
+void queue_conn_request(connector_t* cn, char* onion_id, uint16_t port);
+void take_conn_requests(connector_t* cn, ring_t* rq);
+void start_conn_attempts(connector_t* cn);
+void finish_conn_attempt(connector_t* cn, conn_attempt_t* att, char* reason);
+void handle_conn_event(connector_t* cn, conn_attempt_t* att, uint32_t events);
+int expire_conn_attempts(connector_t* cn);
 
 
 //*********************************
@@ -62,5 +92,6 @@ int handle_remote_conn_request();
 void* th_new_conn();
 int th_new_input();
 void*  th_main_loop();
+void* th_worker(worker_t* wk);
 
 #endif
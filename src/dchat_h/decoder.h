@@ -28,8 +28,34 @@
 //          LIMITS
 //*********************************
 #define MAX_CONTENT_LEN 4096
+#define MAX_CONTACTS_LEN 65536
+#define MAX_OCTET_LEN   1048576
+#define MAX_CONTENT_HARD 0x0fffffff
+#define STREAM_MIN      16384
+#define MAX_HEADER_LEN  1024
+#define MAX_HEADER_BLOCK 2048
 #define HDR_AMOUNT      8
-#define CTT_AMOUNT      4
+#define CTT_AMOUNT      6
+
+
+//*********************************
+//        READER STATES
+//*********************************
+#define RD_STATE_VERSION 0
+#define RD_STATE_HEADER  1
+#define RD_STATE_CONTENT 2
+#define RD_STATE_STREAM  3
+
+#define PDU_AGAIN -2
+
+
+//*********************************
+//        BINARY FRAMING
+//*********************************
+#define FRM_VERSION  0xd1 // first byte of a DChat V1 frame
+#define FRM_IDENT    0x80 // frame carries the identity of the sender
+#define FRM_CTT_MASK 0x7f
+#define FRM_MAX_CTL  4    // bytes of the content-length varint
 
 
 //*********************************
@@ -50,6 +76,9 @@
 #define HDR_ID_DAT 0x07
 #define HDR_ID_SRV 0x08
 
+// headers from Host on describe the sender (see: session mode)
+#define HDR_IS_IDENT(ID) ((ID) >= HDR_ID_ONI)
+
 
 //*********************************
 //         NAME OF HEADER
@@ -71,8 +100,8 @@
 #define CTT_ID_BIN 0x02
 #define CTT_ID_DSC 0x03
 #define CTT_ID_RPY 0x04
-
-#define CTT_MASK_ALL 0x05
+#define CTT_ID_DGT 0x05
+#define CTT_ID_CTL 0x06
 
 
 //*********************************
@@ -82,24 +111,46 @@
 #define CTT_NAME_BIN "application/octet"
 #define CTT_NAME_DSC "control/discover"
 #define CTT_NAME_RPY "control/replay"
+#define CTT_NAME_DGT "control/digest"
+#define CTT_NAME_CTL "control/contacts"
+
+
+//*********************************
+//         CAPABILITIES
+//*********************************
+#define CAP_DIGEST      0x01
+#define CAP_BINLIST     0x02
+#define CAP_FRAME       0x04
+#define CAP_SESSION     0x08
+#define CAP_KNOWN       0x80
+
+#define CAP_NAME_DIGEST "digest"
+#define CAP_NAME_BINLIST "binlist"
+#define CAP_NAME_FRAME  "frame"
+#define CAP_NAME_SESSION "session"
 
 
 //*********************************
 //             MACRO
 //*********************************
 #define HEADER(ID, NAME, MAND, STR2PDU, PDU2STR) { ID, NAME, MAND, STR2PDU, PDU2STR }
-#define CONTENT_TYPE(ID, NAME) { ID, NAME }
+#define CONTENT_TYPE(ID, NAME, MAX, CONSUME) { ID, NAME, MAX, CONSUME }
+#define HDR_KEY(LEN, C) (((LEN) << 8) | (unsigned char) (C))
 
 
 /*!
  * Structure of a DChat content-type.
  * Specifies content-type name and its id for internal
- * use in this program.
+ * use in this program. Content longer than max_len is refused, content
+ * of at least STREAM_MIN bytes is passed in chunks to the consumer,
+ * if there is one, instead of being buffered.
  */
 typedef struct dchat_content_type
 {
     int   ctt_id;
     char* ctt_name;
+    int   max_len;
+    int (*consume)(dchat_pdu_t*, char*, int);
 } dchat_content_type_t;
 
 
@@ -125,7 +176,7 @@ typedef struct dchat_header
     char* header_name;
     int   mandatory;
     int (*str_to_pdu)(char*, dchat_pdu_t*);
-    int (*pdu_to_str)(dchat_pdu_t*, char**);
+    int (*pdu_to_str)(dchat_pdu_t*, char*, int);
 } dchat_header_t;
 
 
@@ -142,16 +193,29 @@ typedef struct dchat_v1
 //*********************************
 //        DECODE FUNCTIONS
 //*********************************
-int decode_header(dchat_pdu_t* pdu, char* line);
+const dchat_header_t* find_header(const char* key, int len);
+const dchat_header_t* find_header_by_id(int header_id);
+int decode_header(dchat_pdu_t* pdu, char* line, int len);
 int read_line(int fd, char** line);
-int read_pdu(int fd, dchat_pdu_t* pdu);
+int fill_reader(int fd, pdu_reader_t* rd);
+void free_reader(pdu_reader_t* rd);
+int decode_frame_header(pdu_reader_t* rd);
+int begin_content(pdu_reader_t* rd);
+int next_pdu(pdu_reader_t* rd, dchat_pdu_t* pdu);
+int read_pdu(int fd, pdu_reader_t* rd, dchat_pdu_t* pdu);
 
 
 //*********************************
 //        ENCODE FUNCTIONS
 //*********************************
-int encode_header(dchat_pdu_t* pdu, int header_id, char** headerline);
-int write_pdu(int fd, dchat_pdu_t* pdu);
+int encode_header(dchat_pdu_t* pdu, int header_id, char* buf, int size);
+int encode_pdu_header(dchat_pdu_t* pdu, int ident, char* buf, int size);
+int encode_frame_header(dchat_pdu_t* pdu, int ident, char* buf, int size);
+wire_buf_t* new_wire_buf(char* header, int len, dchat_pdu_t* pdu);
+wire_buf_t* encode_pdu(dchat_pdu_t* pdu, int ident);
+wire_buf_t* encode_frame(dchat_pdu_t* pdu, int ident);
+void hold_wire_buf(wire_buf_t* wb);
+void release_wire_buf(wire_buf_t* wb);
 
 
 //*********************************
@@ -166,21 +230,19 @@ int nic_str_to_pdu(char* value, dchat_pdu_t* pdu);
 int dat_str_to_pdu(char* value, dchat_pdu_t* pdu);
 int srv_str_to_pdu(char* value, dchat_pdu_t* pdu);
 
-int ver_pdu_to_str(dchat_pdu_t* pdu, char** value);
-int ctt_pdu_to_str(dchat_pdu_t* pdu, char** value);
-int ctl_pdu_to_str(dchat_pdu_t* pdu, char** value);
-int oni_pdu_to_str(dchat_pdu_t* pdu, char** value);
-int lnp_pdu_to_str(dchat_pdu_t* pdu, char** value);
-int nic_pdu_to_str(dchat_pdu_t* pdu, char** value);
-int dat_pdu_to_str(dchat_pdu_t* pdu, char** value);
-int srv_pdu_to_str(dchat_pdu_t* pdu, char** value);
+int ver_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int ctt_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int ctl_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int oni_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int lnp_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int nic_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int dat_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
+int srv_pdu_to_str(dchat_pdu_t* pdu, char* value, int size);
 
 
 //*********************************
 //        INIT FUNCTIONS
 //*********************************
-int init_dchat_content_types(dchat_content_types_t* ctt);
-int init_dchat_v1(dchat_v1_t* proto);
 int init_dchat_pdu(dchat_pdu_t* pdu, float version, int content_type,
                    char* onion_id,
                    int lport, char* nickname);
@@ -194,9 +256,14 @@ int is_valid_termination(char* value);
 int is_valid_version(float version);
 int is_valid_content_type(int content_type);
 int is_valid_content_length(int ctl);
+const dchat_content_type_t* find_content_type(int content_type);
+int content_limit(int content_type);
+int set_content_limit(char* name, int len);
 int is_valid_nickname(char* nickname);
+int copy_value(char* value, int size, const char* str);
 void free_pdu(dchat_pdu_t* pdu);
-int get_content_part(dchat_pdu_t* pdu, int offset, char term, char** content);
+int next_content_line(dchat_pdu_t* pdu, int* offset, char term, char** line, int* len);
+int parse_capabilities(char* server);
 
 
 #endif
@@ -29,46 +29,15 @@
 //     TOR SETTINGS
 //*********************************
 #define ONION_ADDRLEN   22
+#define ONION_BINLEN    10
 #define TOR_PORT        9050
 #define TOR_ADDR        "127.0.0.1"
 
 
-//*********************************
-//     SOCKS4a FIELDS
-//*********************************
-#define SOCKS_CONNECT   0x01
-#define SOCKS_RESOLVE   0xF0
-#define SOCKS_VERSION   0x04
-#define SOCKS_DELIM     0x00
-#define SOCKS_FAKEIP    0x01
-
-
-/*!
- * Structure for a SOCKS4a PDU
- */
-typedef struct socks4a_pdu
-{
-    uint8_t  version;   //!< SOCKS version (e.g 4/5)
-    uint8_t  command;   //!< SOCKS command type (e.g. CONNECT, BIND, ...)
-    uint16_t port;      //!< port of remote client
-    uint32_t fakeip;    //!< invalid ip address (see: SOCKS4a protocol)
-    uint8_t  delim;     //!< SOCKS delimiter
-    char*    hostname;  //!< domain name of client to connect to
-} socks4a_pdu_t;
-
-
-//*********************************
-//       SOCKS FUNCTIONS
-//*********************************
-int write_socks4a(int s, socks4a_pdu_t* pdu);
-int read_socks4a(int s, socks4a_pdu_t* pdu);
-char* parse_socks_status(unsigned char status);
-
-
 //*********************************
 //       TOR FUNCTIONS
 //*********************************
-int create_tor_socket(char* hostname, uint16_t rport);
+int connect_tor_async();
 
 
 //*********************************
@@ -76,8 +45,11 @@ int create_tor_socket(char* hostname, uint16_t rport);
 //*********************************
 int ip_version(struct sockaddr_storage* addr);
 int connect_to(struct sockaddr* sa);
+int set_nonblocking(int fd);
 int is_valid_port(int port);
 int is_valid_onion(char* onion_id);
+int onion_to_bin(const char* onion_id, unsigned char* bin);
+void bin_to_onion(const unsigned char* bin, char* onion_id);
 
 
 #endif
@@ -29,7 +29,7 @@
 //*********************************
 //            MISC
 //*********************************
-#define CLI_OPT_AMOUNT 6
+#define CLI_OPT_AMOUNT 15
 
 //*********************************
 //  COMMAND LINE OPTIONS (SHORT)
@@ -39,6 +39,15 @@
 #define CLI_OPT_LPRT "l"
 #define CLI_OPT_RONI "d"
 #define CLI_OPT_RPRT "r"
+#define CLI_OPT_QHGH "H"
+#define CLI_OPT_QLOW "L"
+#define CLI_OPT_QTMO "T"
+#define CLI_OPT_WORK "w"
+#define CLI_OPT_CONN "c"
+#define CLI_OPT_CTMO "C"
+#define CLI_OPT_BWIN "b"
+#define CLI_OPT_BMAX "B"
+#define CLI_OPT_MLEN "m"
 #define CLI_OPT_HELP "h"
 
 
@@ -50,6 +59,15 @@
 #define CLI_LOPT_LPRT "lport"
 #define CLI_LOPT_RONI "ronion"
 #define CLI_LOPT_RPRT "rport"
+#define CLI_LOPT_QHGH "qhigh"
+#define CLI_LOPT_QLOW "qlow"
+#define CLI_LOPT_QTMO "qtimeout"
+#define CLI_LOPT_WORK "workers"
+#define CLI_LOPT_CONN "connects"
+#define CLI_LOPT_CTMO "ctimeout"
+#define CLI_LOPT_BWIN "batch"
+#define CLI_LOPT_BMAX "maxbatch"
+#define CLI_LOPT_MLEN "maxlen"
 #define CLI_LOPT_HELP "help"
 
 
@@ -61,6 +79,15 @@
 #define CLI_OPT_ARG_LPRT "LOCALPORT"
 #define CLI_OPT_ARG_RONI "REMOTEONIONID"
 #define CLI_OPT_ARG_RPRT "REMOTEPORT"
+#define CLI_OPT_ARG_QHGH "BYTES"
+#define CLI_OPT_ARG_QLOW "BYTES"
+#define CLI_OPT_ARG_QTMO "SECONDS"
+#define CLI_OPT_ARG_WORK "WORKERS"
+#define CLI_OPT_ARG_CONN "CONNECTS"
+#define CLI_OPT_ARG_CTMO "SECONDS"
+#define CLI_OPT_ARG_BWIN "MSEC"
+#define CLI_OPT_ARG_BMAX "MESSAGES"
+#define CLI_OPT_ARG_MLEN "TYPE=BYTES"
 #define CLI_OPT_ARG_HELP ""
 
 
@@ -109,11 +136,21 @@ int read_conf(char* filepath, int* required_set);
 //*********************************
 //      CMD PARSING FUNCTIONS
 //*********************************
+int parse_positive(char* value);
 int loni_parse(char* value, int force);
 int nick_parse(char* value, int force);
 int lprt_parse(char* value, int force);
 int roni_parse(char* value, int force);
 int rprt_parse(char* value, int force);
+int qhgh_parse(char* value, int force);
+int qlow_parse(char* value, int force);
+int qtmo_parse(char* value, int force);
+int work_parse(char* value, int force);
+int conn_parse(char* value, int force);
+int ctmo_parse(char* value, int force);
+int bwin_parse(char* value, int force);
+int bmax_parse(char* value, int force);
+int mlen_parse(char* value, int force);
 int help_parse(char* value, int force);
 
 #endif
@@ -0,0 +1,66 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// see: http://www.openssh.com/txt/socks4a.protocol
+
+#ifndef SOCKS_H
+#define SOCKS_H
+
+#include <stdint.h>
+
+
+//*********************************
+//     SOCKS4a FIELDS
+//*********************************
+#define SOCKS_CONNECT   0x01
+#define SOCKS_RESOLVE   0xF0
+#define SOCKS_VERSION   0x04
+#define SOCKS_DELIM     0x00
+#define SOCKS_FAKEIP    0x01
+#define SOCKS_GRANTED   90
+#define SOCKS_REPLYLEN  8
+#define SOCKS_MAXHOST   255
+
+
+/*!
+ * Structure for a SOCKS4a reply.
+ * The reply may arrive in pieces, so it is collected in `buf` until
+ * SOCKS_REPLYLEN bytes have been read. The fields are parsed afterwards.
+ */
+typedef struct socks4a_reply
+{
+    unsigned char buf[SOCKS_REPLYLEN]; //!< raw reply read so far
+    int len;                           //!< bytes of raw reply read
+    uint8_t  status;                   //!< status of request (e.g. granted)
+    uint16_t port;                     //!< port (ignored by SOCKS4a)
+    uint32_t ip;                       //!< ip address (ignored by SOCKS4a)
+} socks4a_reply_t;
+
+
+//*********************************
+//       SOCKS FUNCTIONS
+//*********************************
+int build_socks4a(char* buf, int size, char* hostname, uint16_t port);
+int write_socks4a(int s, char* hostname, uint16_t port);
+int read_socks4a(int s, socks4a_reply_t* reply);
+char* parse_socks_status(unsigned char status);
+
+
+#endif
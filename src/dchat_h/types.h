@@ -24,9 +24,30 @@
 #include <netinet/in.h>
 #include <time.h>
 #include "network.h"
+#include "socks.h"
+#include "util.h"
 
 #define FRAME_BUF_LEN  4096
 #define INIT_CONTACTS  30
+#define INIT_QUEUE     16
+#define FLUSH_IOV      64
+#define QUEUE_HIGH     65536
+#define QUEUE_LOW      16384
+#define QUEUE_TIMEOUT  30
+#define MAX_EVENTS     64
+#define MAX_WORKERS    64
+#define MSG_ADD        0x01
+#define MSG_SEND       0x02
+#define MSG_DEL        0x03
+#define CONNECTS       16
+#define CONN_TIMEOUT   60
+#define CONN_FREE      0
+#define CONN_TCP       1
+#define CONN_SOCKS     2
+#define BATCH_WINDOW   5
+#define BATCH_MAX      32
+#define INPUT_RING     1024
+#define CONNECT_RING   4096
 #define MAX_NICKNAME   31
 
 
@@ -48,8 +69,62 @@ typedef struct dchat_pdu
     char nickname[MAX_NICKNAME + 1];   //!< nickname of the client
     struct tm sent;                    //!< receive time of pdu (Date header)
     char* server;                      //!< type of server that crafted this pdu
+    int interned;                      //!< identity taken from session state?
+    int streamed;                      //!< content bytes passed to consumer
+    unsigned checksum;                 //!< FNV-1a hash of streamed content
 } dchat_pdu_t;
 
+/*!
+ * Structure for a buffered PDU reader.
+ * Every connection owns one of these, so that data can be received
+ * in chunks of FRAME_BUF_LEN bytes and split into headers and content
+ * afterwards. Parsing state is kept between chunks, therefore a PDU may
+ * arrive in arbitrary pieces.
+ */
+typedef struct pdu_reader
+{
+    char* buf;                         //!< receive buffer
+    int size;                          //!< allocated size of receive buffer
+    int len;                           //!< bytes stored in receive buffer
+    int off;                           //!< offset of first unparsed byte
+    int syscalls;                      //!< recv(2) calls since last PDU
+    int state;                         //!< what is parsed next
+    int pdu_len;                       //!< bytes of current PDU parsed
+    dchat_pdu_t pdu;                   //!< partially parsed PDU
+    char onion_id[ONION_ADDRLEN + 1]; //!< interned onion address of sender
+    uint16_t lport;                    //!< interned listening port of sender
+    char nickname[MAX_NICKNAME + 1];   //!< interned nickname of sender
+} pdu_reader_t;
+
+/*!
+ * Structure for an encoded PDU as it is sent over the wire.
+ * The data is immutable once encoded, thus the same buffer can be
+ * queued for several contacts. It is freed when the last reference
+ * has been released.
+ */
+typedef struct wire_buf
+{
+    int refs;                          //!< reference counter
+    int len;                           //!< length of encoded PDU
+    char data[];                       //!< encoded PDU
+} wire_buf_t;
+
+/*!
+ * Structure for the outbound queue of a connection.
+ * Queued wire buffers are stored in a ring. A queue exceeding the
+ * high watermark is congested until it drains below the low watermark.
+ */
+typedef struct out_queue
+{
+    wire_buf_t** wb;                   //!< ring of queued wire buffers
+    int size;                          //!< capacity of ring
+    int head;                          //!< index of first queued buffer
+    int cnt;                           //!< amount of queued buffers
+    int off;                           //!< bytes of first buffer written
+    int bytes;                         //!< bytes queued, not written yet
+    time_t congested;                  //!< time high watermark was exceeded
+} out_queue_t;
+
 /*!
  * Structure for contact information
  */
@@ -60,34 +135,207 @@ typedef struct contact
     uint16_t lport;                   //!< listening port of hidden service
     char name[MAX_NICKNAME + 1];      //!< nickname
     int accepted;                     //!< connect to or accepted contact?
+    int caps;                         //!< capabilities announced by contact
+    pdu_reader_t rd;                  //!< receive buffer of TCP session
+    out_queue_t oq;                   //!< send queue of TCP session
+    uint32_t events;                  //!< events registered at epoll(7)
+    int ident_sent;                   //!< has our identity been sent to contact?
+    int next;                         //!< next contact in hash bucket or free-list
+    int slot;                         //!< index of contact in contactlist
 } contact_t;
 
 /*!
- * Structure storing client contacts
+ * Structure storing client contacts.
+ * Contacts are stored in chunks of INIT_CONTACTS contacts. Chunks are
+ * never moved or freed, so the index of a contact stays valid as long as
+ * the contact exists. Free slots are linked by `next`.
  */
 typedef struct contactlist
 {
-    contact_t* contact;         //!< array of contacts
-    pthread_mutex_t cl_mx;      //!< mutex to signal lock
-    int cl_size;                //!< size of array
+    contact_t** chunk;          //!< chunks of contacts
+    int cl_size;                //!< amount of slots in all chunks
     int used_contacts;          //!< elements used in contact array
+    int free_slot;              //!< first slot of free-list
+    int congested;              //!< amount of congested send queues
+    int* bucket;                //!< hash index: first contact of bucket or -1
+    int buckets;                //!< amount of buckets, a power of two
+    unsigned gen;               //!< incremented if a slot is reused
 } contactlist_t;
 
+/*!
+ * Structure for a contact published in a directory.
+ */
+typedef struct dir_entry
+{
+    int fd;                           //!< file descriptor of TCP session
+    char onion_id[ONION_ADDRLEN + 1]; //!< onion address of hidden service
+    uint16_t lport;                   //!< listening port of hidden service
+    char name[MAX_NICKNAME + 1];      //!< nickname
+    int accepted;                     //!< connect to or accepted contact?
+    int slot;                         //!< index of contact in contactlist
+    int next;                         //!< next entry in hash bucket or -1
+} dir_entry_t;
+
+/*!
+ * Structure for a directory.
+ * A directory is a read-only snapshot of the contacts of a worker. Other
+ * threads read it without locking, the worker publishes a new one whenever
+ * its contacts change. Replaced directories are freed as soon as no reader
+ * can reference them anymore (see reclaim_directories()).
+ */
+typedef struct directory
+{
+    int cnt;                    //!< amount of entries
+    int buckets;                //!< amount of buckets, a power of two
+    int* bucket;                //!< hash index: first entry of bucket or -1
+    dir_entry_t* entry;         //!< published contacts
+    unsigned long retired;      //!< epoch the directory has been replaced in
+    struct directory* next;     //!< next retired directory
+} directory_t;
+
+/*!
+ * Structure for a reader of directories.
+ */
+typedef struct reader
+{
+    unsigned long active;       //!< epoch announced by reader, 0 if idle
+    int depth;                  //!< nesting of read-side critical sections
+} reader_t;
+
+/*!
+ * Structure for a message passed to a worker.
+ */
+typedef struct worker_msg
+{
+    int type;                         //!< MSG_ADD, MSG_SEND or MSG_DEL
+    int fd;                           //!< socket of contact
+    int accepted;                     //!< connect to or accepted contact?
+    char onion_id[ONION_ADDRLEN + 1]; //!< onion address of contact
+    uint16_t lport;                   //!< listening port of contact
+    wire_buf_t* wb;                   //!< wire buffer to send (MSG_SEND)
+    wire_buf_t* sb;                   //!< same PDU without identity (MSG_SEND)
+    wire_buf_t* fb;                   //!< same PDU as binary frame (MSG_SEND)
+    struct worker_msg* next;          //!< next message in inbox
+} worker_msg_t;
+
+/*!
+ * Structure for an event loop thread.
+ * Every worker owns a slice of the contacts and its own poller. Only
+ * the worker itself accesses its contactlist, other threads read its
+ * published directory. Everything else is passed as message.
+ */
+typedef struct worker
+{
+    contactlist_t cl;           //!< contacts owned by this worker
+    directory_t* dir;           //!< published snapshot of contacts
+    directory_t* retired;       //!< replaced directories not freed yet
+    int dir_dirty;              //!< contacts changed since last publication
+    reader_t rcu;               //!< reader record of worker thread
+    int epfd;                   //!< epoll(7) instance of worker
+    int inbox;                  //!< eventfd(2) to signal new messages
+    ring_t connect_rq;          //!< connection requests to connector
+    worker_msg_t* msg_head;     //!< first message of inbox
+    worker_msg_t* msg_tail;     //!< last message of inbox
+    pthread_mutex_t msg_mx;     //!< mutex to lock inbox
+    pthread_t th;               //!< thread running the event loop
+} worker_t;
+
+/*!
+ * Structure for a connection request waiting for the connector.
+ */
+typedef struct conn_req
+{
+    char onion_id[ONION_ADDRLEN + 1]; //!< onion address to connect to
+    uint16_t lport;                   //!< port to connect to
+} conn_req_t;
+
+/*!
+ * Structure for a connection attempt in flight.
+ */
+typedef struct conn_attempt
+{
+    int fd;                           //!< socket to the TOR client
+    int state;                        //!< CONN_FREE, CONN_TCP or CONN_SOCKS
+    char onion_id[ONION_ADDRLEN + 1]; //!< onion address to connect to
+    uint16_t lport;                   //!< port to connect to
+    socks4a_reply_t reply;            //!< SOCKS reply read so far
+    unsigned long started;            //!< time the attempt was started (ms)
+    unsigned long deadline;           //!< time the attempt is given up (ms)
+} conn_attempt_t;
+
+/*!
+ * Structure for the connector.
+ * The connector keeps several SOCKS handshakes in flight at once, so that
+ * joining a chat costs about one circuit setup instead of one per contact.
+ * Requests exceeding the concurrency limit wait in a ring.
+ */
+typedef struct connector
+{
+    int epfd;                   //!< epoll(7) instance of connector
+    conn_attempt_t* att;        //!< attempts, `connects` slots
+    int active;                 //!< attempts in flight
+    conn_req_t* pend;           //!< ring of waiting requests
+    int pend_size;              //!< capacity of ring
+    int pend_head;              //!< index of first waiting request
+    int pend_cnt;               //!< amount of waiting requests
+} connector_t;
+
+/*!
+ * Structure for runtime statistics
+ */
+typedef struct dchat_stats
+{
+    unsigned long rx_pdus;      //!< PDUs received from contacts
+    unsigned long rx_bytes;     //!< bytes received from contacts
+    unsigned long rx_syscalls;  //!< recv(2) calls needed for these PDUs
+    unsigned long socks_ok;     //!< SOCKS handshakes granted
+    unsigned long socks_failed; //!< SOCKS handshakes failed or timed out
+    unsigned long socks_msec;   //!< total duration of granted handshakes
+    unsigned long socks_max;    //!< longest granted handshake (ms)
+} dchat_stats_t;
+
+/*!
+ * Structure for text messages of the user waiting to be sent.
+ * Messages entered within the batching window are passed to the
+ * workers at once, so that they are written with a single writev(2).
+ */
+typedef struct batch
+{
+    dchat_pdu_t* pdu;           //!< pending text messages, `bmax` slots
+    int cnt;                    //!< amount of pending messages
+    unsigned long deadline;     //!< when the batch is sent (ms, monotonic)
+} batch_t;
+
 /*!
  * Structure for global configurations
  */
 typedef struct dchat_conf
 {
-    contactlist_t cl;           //!< contact list
+    worker_t* wk;               //!< event loop threads
+    int workers;                //!< amount of event loop threads
+    unsigned next_wk;           //!< worker of next new connection
     contact_t me;               //!< local contact information
+    contact_t remote;           //!< remote host to connect to at start
     struct sockaddr_storage sa; //!< local socket address
     int acpt_fd;                //!< listening socket
-    int in_fd, out_fd, log_fd;  //!< console input, output and log
-    int connect_fd[2];          //!< pipe to connector
-    int cl_change[2];           //!< pipe to signal wait loop from connect
-    int user_input[2];          //!< pipe to signal a new user input from stdin
+    int epfd;                   //!< epoll(7) instance of main loop
+    int connect_efd;            //!< eventfd(2) of connector
+    ring_t connect_rq;          //!< connection requests of main loop
+    ring_t user_input;          //!< lines entered by the user
     pthread_t conn_th;          //!< thread responsible for new connections
-    pthread_t select_th;        //!< thread responsible for select(2) fd
+    pthread_t select_th;        //!< thread responsible for local input
+    dchat_stats_t st;           //!< runtime statistics
+    int qhigh;                  //!< high watermark of send queues
+    int qlow;                   //!< low watermark of send queues
+    int qtimeout;               //!< seconds a queue may exceed qhigh
+    connector_t cn;             //!< state of connector thread
+    unsigned long epoch;        //!< epoch of directories
+    reader_t rcu;               //!< reader record of main loop
+    int connects;               //!< connection attempts in flight at most
+    int ctimeout;               //!< seconds a connection attempt may take
+    batch_t batch;              //!< text messages waiting to be sent
+    int bwindow;                //!< milliseconds messages are batched
+    int bmax;                   //!< messages per batch at most
 } dchat_conf_t;
 
 
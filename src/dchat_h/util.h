@@ -23,9 +23,28 @@
 
 #include <netinet/in.h>
 #include <limits.h>
+#include <time.h>
 
 //max. amount of chars for integer str representation
 #define MAX_INT_STR ((CHAR_BIT * sizeof(int) - 1) / 3 + 2)
+#define CACHE_LINE 64
+#define FNV_BASIS 2166136261u // initial value of FNV-1a hashes
+
+
+/*!
+ * Lock-free ring buffer of fixed size slots for exactly one producer and
+ * one consumer thread. The consumer is woken up by an eventfd(2), which
+ * may be shared by several rings with the same consumer.
+ */
+typedef struct ring
+{
+    char* buf;                  //!< slots of `esize` bytes
+    int esize;                  //!< size of a slot
+    unsigned size;              //!< amount of slots, power of two
+    int efd;                    //!< eventfd(2) ringing the consumer
+    unsigned head __attribute__((aligned(CACHE_LINE))); //!< next slot to pop
+    unsigned tail __attribute__((aligned(CACHE_LINE))); //!< next slot to push
+} ring_t;
 
 
 //*********************************
@@ -35,5 +54,19 @@ int max(int a, int b);
 int file_exists(char* filename);
 char* remove_leading_spaces(char* value);
 int iszero(void* ptr, int n);
+time_t mono_time();
+unsigned long mono_msec();
+unsigned fnv1a(unsigned h, const char* buf, int len);
+
+
+//*********************************
+//     RING BUFFER FUNCTIONS
+//*********************************
+int init_ring(ring_t* rg, int esize, unsigned size, int efd);
+void free_ring(ring_t* rg);
+int ring_push(ring_t* rg, const void* e);
+int ring_pop(ring_t* rg, void* e);
+int ring_notify(int efd);
+void ring_drain(int efd);
 
 #endif
@@ -32,108 +32,178 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
 
 #include "dchat_h/decoder.h"
 #include "dchat_h/network.h"
 #include "dchat_h/util.h"
 #include "dchat_h/consoleui.h"
+#include "dchat_h/dchat.h"
 
 
-/**
- *  Decodes a string into a DChat header.
- *  Attempts to decode the given \\n terminated line and sets
- *  corresponding header attributes in the given pdu.
- *  @param pdu  Pointer to PDU structure where header attributes
- *  will be set
- *  @param line Line to parse for dchat-headers; must be \\n terminated
- *  @return 0 if line is a dchat header, -1 otherwise
+/*!
+ * Headers of DChat V1 ordered by their IDs.
+ * The table is built at compile time, so that it does not have to be
+ * initialized for every encoded or decoded header.
  */
-int
-decode_header(dchat_pdu_t* pdu, char* line)
+static const dchat_v1_t _proto_v1 =
 {
-    char* temp;
-    char* key;          // header key (e.g. Content-Type)
-    char* value;        // header value (e.g. text/plain)
-    char* delim = ":";  // delimiter char
-    char* save_ptr;     // used for strtok
-    int len;            // length of value
-    int end;            // index of termination chars (\r)\n of value
-    int ret;            // return of parsed value
-    dchat_v1_t proto;   // DChat V1 headers
-
-    if (line == NULL)
     {
-        return -1;
+        HEADER(HDR_ID_VER, HDR_NAME_VER, 1, ver_str_to_pdu, ver_pdu_to_str),
+        HEADER(HDR_ID_CTT, HDR_NAME_CTT, 1, ctt_str_to_pdu, ctt_pdu_to_str),
+        HEADER(HDR_ID_CTL, HDR_NAME_CTL, 1, ctl_str_to_pdu, ctl_pdu_to_str),
+        HEADER(HDR_ID_ONI, HDR_NAME_ONI, 1, oni_str_to_pdu, oni_pdu_to_str),
+        HEADER(HDR_ID_LNP, HDR_NAME_LNP, 1, lnp_str_to_pdu, lnp_pdu_to_str),
+        HEADER(HDR_ID_NIC, HDR_NAME_NIC, 0, nic_str_to_pdu, nic_pdu_to_str),
+        HEADER(HDR_ID_DAT, HDR_NAME_DAT, 0, dat_str_to_pdu, dat_pdu_to_str),
+        HEADER(HDR_ID_SRV, HDR_NAME_SRV, 0, srv_str_to_pdu, srv_pdu_to_str)
     }
+};
 
-    // copy line to work with
-    temp = malloc(strlen(line) + 1);
 
-    if (temp == NULL)
+/*!
+ * Content-types of DChat V1.
+ * The limits of the content-length may be changed at startup.
+ * @see set_content_limit()
+ */
+static dchat_content_types_t _ctt_v1 =
+{
     {
-        ui_fatal("Memory allocation for temporary decoder line failed!");
+        CONTENT_TYPE(CTT_ID_TXT, CTT_NAME_TXT, MAX_CONTENT_LEN, NULL),
+        CONTENT_TYPE(CTT_ID_BIN, CTT_NAME_BIN, MAX_OCTET_LEN, consume_octet),
+        CONTENT_TYPE(CTT_ID_DSC, CTT_NAME_DSC, MAX_CONTACTS_LEN, NULL),
+        CONTENT_TYPE(CTT_ID_RPY, CTT_NAME_RPY, MAX_CONTENT_LEN, NULL),
+        CONTENT_TYPE(CTT_ID_DGT, CTT_NAME_DGT, MAX_CONTENT_LEN, NULL),
+        CONTENT_TYPE(CTT_ID_CTL, CTT_NAME_CTL, MAX_CONTACTS_LEN, NULL)
     }
+};
+
 
-    temp[0] = '\0';
-    strcat(temp, line);
+/**
+ *  Looks up a DChat header by its name.
+ *  The header is selected by the length and the first character of the
+ *  given key, thus only one name has to be compared.
+ *  @param key Header name (does not have to be \\0 terminated)
+ *  @param len Length of header name
+ *  @return Pointer to the header or NULL if there is no such header
+ */
+const dchat_header_t*
+find_header(const char* key, int len)
+{
+    const dchat_header_t* hdr;
 
-    // split line: header format -> key:value
-    if ((key = strtok_r(temp, delim, &save_ptr)) == NULL)
+    switch (HDR_KEY(len, key[0]))
     {
-        free(temp);
-        return -1;
+        case HDR_KEY(sizeof(HDR_NAME_VER) - 1, 'D'):
+            hdr = &_proto_v1.header[HDR_ID_VER - 1];
+            break;
+
+        case HDR_KEY(sizeof(HDR_NAME_CTT) - 1, 'C'):
+            hdr = &_proto_v1.header[HDR_ID_CTT - 1];
+            break;
+
+        case HDR_KEY(sizeof(HDR_NAME_CTL) - 1, 'C'):
+            hdr = &_proto_v1.header[HDR_ID_CTL - 1];
+            break;
+
+        case HDR_KEY(sizeof(HDR_NAME_ONI) - 1, 'H'):
+            hdr = &_proto_v1.header[HDR_ID_ONI - 1];
+            break;
+
+        case HDR_KEY(sizeof(HDR_NAME_LNP) - 1, 'L'):
+            hdr = &_proto_v1.header[HDR_ID_LNP - 1];
+            break;
+
+        case HDR_KEY(sizeof(HDR_NAME_NIC) - 1, 'N'):
+            hdr = &_proto_v1.header[HDR_ID_NIC - 1];
+            break;
+
+        case HDR_KEY(sizeof(HDR_NAME_DAT) - 1, 'D'):
+            hdr = &_proto_v1.header[HDR_ID_DAT - 1];
+            break;
+
+        case HDR_KEY(sizeof(HDR_NAME_SRV) - 1, 'S'):
+            hdr = &_proto_v1.header[HDR_ID_SRV - 1];
+            break;
+
+        default:
+            return NULL;
     }
 
-    // value token is NULL
-    if (save_ptr == NULL)
+    return memcmp(key, hdr->header_name, len) ? NULL : hdr;
+}
+
+
+/**
+ *  Looks up a DChat header by its ID.
+ *  @param header_id ID of the header (e.g. HDR_ID_CTT)
+ *  @return Pointer to the header or NULL if there is no such header
+ */
+const dchat_header_t*
+find_header_by_id(int header_id)
+{
+    if (header_id < 1 || header_id > HDR_AMOUNT)
     {
-        free(temp);
-        return -1;
+        return NULL;
     }
 
-    // key is the very first token of line, whereas
-    // value contains the rest of the line string (inc. possible delim chars e.g. date header)
-    value = save_ptr;
+    return &_proto_v1.header[header_id - 1];
+}
 
-    // first character must be a whitespace
-    if (strncmp(value, " ", 1) != 0)
+
+/**
+ *  Decodes a string into a DChat header.
+ *  Attempts to decode the given \\n terminated line and sets
+ *  corresponding header attributes in the given pdu. The line is parsed
+ *  in place, therefore its termination characters will be overwritten.
+ *  @param pdu  Pointer to PDU structure where header attributes
+ *  will be set
+ *  @param line Line to parse for dchat-headers; must be \\n terminated
+ *  @param len  Length of line
+ *  @return 0 if line is a dchat header, -1 otherwise
+ */
+int
+decode_header(dchat_pdu_t* pdu, char* line, int len)
+{
+    const dchat_header_t* hdr; // header of line
+    char* value;               // header value (e.g. text/plain)
+    int end;                   // index of termination chars (\r)\n of value
+
+    // value must end with \n
+    if (line == NULL || len < 1 || line[len - 1] != '\n')
     {
-        free(temp);
         return -1;
     }
 
-    // skip " "
-    value++;
+    end = len - 1;
 
-    if ((ret = is_valid_termination(value)) == -1)
+    if (end > 0 && line[end - 1] == '\r')
     {
-        free(temp);
-        return -1;
+        end--;
     }
 
-    // remove termination characters
-    value[ret] = '\0';
+    // split line: header format -> key: value
+    if ((value = memchr(line, ':', end)) == NULL)
+    {
+        return -1;
+    }
 
-    if (init_dchat_v1(&proto) == -1)
+    if ((hdr = find_header(line, value - line)) == NULL)
     {
-        free(temp);
         return -1;
     }
 
-    // iterate through headers and check if value is valid
-    // if valid parse value and set attributes in the PDU
-    for (int i = 0; i < HDR_AMOUNT; i++)
+    // first character must be a whitespace
+    if (++value >= line + end || *value != ' ')
     {
-        if (!strcmp(key, proto.header[i].header_name))
-        {
-            ret = proto.header[i].str_to_pdu(value, pdu);
-            free(temp);
-            return ret;
-        }
+        return -1;
     }
 
-    free(temp);
-    return -1;
+    // skip " " and remove termination characters
+    value++;
+    line[end] = '\0';
+    return hdr->str_to_pdu(value, pdu);
 }
 
 
@@ -188,126 +258,564 @@ read_line(int fd, char** line)
 
 
 /**
- *  Read a whole DChat PDU from a file descriptor.
- *  Read linewise from a file descriptor to form a DChat protocol data unit.
- *  Information read from the file descriptor will be stored in this pdu.
- *  @param fd  File descriptor to read from
- *  @param pdu Pointer to a PDU structure whose headers will be filled.
- *  @return amount of bytes read in total if a protocol data unit has been read successfully, 0 on EOF ,
- *  -1 on error
+ *  Receives the next chunk of data into the receive buffer of a connection.
+ *  Bytes that have already been parsed are discarded first. If there is
+ *  no room left for another FRAME_BUF_LEN bytes, the buffer will be enlarged.
+ *  @param fd File descriptor to read from
+ *  @param rd Pointer to the reader of the connection
+ *  @return amount of bytes received, 0 on EOF, -1 on error
  */
 int
-read_pdu(int fd, dchat_pdu_t* pdu)
+fill_reader(int fd, pdu_reader_t* rd)
 {
-    char* line;     // line read from file descriptor
-    char* contentp; // content pointer
-    int ret;        // return value
-    int b;          // amount of bytes read as content
-    int len = 0;    // amount of bytes read in total
-    // zero out structure
-    memset(pdu, 0, sizeof(*pdu));
+    char* alc_ptr; // used for realloc
+    int ret;       // return value
 
-    // read each line of the received pdu
-    if ((ret = read_line(fd, &line)) == -1 || !ret)
+    // discard bytes which have already been parsed
+    if (rd->off > 0)
     {
-        return ret;
+        memmove(rd->buf, rd->buf + rd->off, rd->len - rd->off);
+        rd->len -= rd->off;
+        rd->off = 0;
+    }
+
+    // make room for another chunk (+1 for a terminating \0)
+    if (rd->size - rd->len < FRAME_BUF_LEN)
+    {
+        if ((alc_ptr = realloc(rd->buf, rd->len + FRAME_BUF_LEN + 1)) == NULL)
+        {
+            ui_fatal("Reallocation of receive buffer failed!");
+        }
+
+        rd->buf  = alc_ptr;
+        rd->size = rd->len + FRAME_BUF_LEN;
     }
 
-    // first header must be version header
-    if (decode_header(pdu, line) == -1 || pdu->version != DCHAT_V1)
+    do
     {
-        ret = -1;
+        rd->syscalls++;
+        ret = recv(fd, rd->buf + rd->len, rd->size - rd->len, 0);
     }
+    while (ret == -1 && errno == EINTR);
 
-    if (ret != -1)
+    if (ret > 0)
     {
-        len += strlen(line);
-        free(line);
+        rd->len += ret;
+    }
+
+    return ret;
+}
+
 
-        // read header lines from file descriptors, until
-        // an empty line is received
-        while ((ret = read_line(fd, &line)) != -1 || ret == 0)
+/**
+ *  Frees the receive buffer of a connection.
+ *  A partially parsed PDU will be freed as well.
+ *  @param rd Pointer to the reader of the connection
+ */
+void
+free_reader(pdu_reader_t* rd)
+{
+    if (rd->buf != NULL)
+    {
+        free(rd->buf);
+    }
+
+    free_pdu(&rd->pdu);
+    memset(rd, 0, sizeof(*rd));
+}
+
+
+/**
+ *  Parses the header of a binary frame out of the receive buffer.
+ *  A frame starts with FRM_VERSION, followed by the content-type whose
+ *  FRM_IDENT bit tells if the identity of the sender follows, and the
+ *  content-length as varint (7 bits per byte, least significant first).
+ *  The identity consists of the onion-id, the listening port (network
+ *  byte order) and the length prefixed nickname and server. It is
+ *  interned by the reader, frames without it refer to the identity of
+ *  the last PDU received on this connection.
+ *  @param rd Pointer to the reader of the connection
+ *  @return 0 if the header has been parsed, PDU_AGAIN if more data is
+ *          required or -1 on error
+ */
+int
+decode_frame_header(pdu_reader_t* rd)
+{
+    unsigned char* begin = (unsigned char*) rd->buf + rd->off; // frame header
+    unsigned char* end = (unsigned char*) rd->buf + rd->len;   // buffered data
+    unsigned char* p = begin + 2;                               // parse position
+    int ctl = 0;                                                // content-length
+    int len;                                                    // length of a string
+    int i;
+
+    if (end - begin < 2)
+    {
+        return PDU_AGAIN;
+    }
+
+    for (i = 0; ; i++, p++)
+    {
+        if (p == end)
         {
-            len += strlen(line);
+            return PDU_AGAIN;
+        }
 
-            if (decode_header(pdu, line) == -1)
-            {
-                // if line is not a header, it must be an empty line
-                if (!strcmp(line, "\n") || !strcmp(line, "\r\n"))
-                {
-                    break; // All headers have been read
-                }
+        if (i == FRM_MAX_CTL)
+        {
+            ui_log(LOG_ERR, "Content-Length of frame exceeds %d bytes!", FRM_MAX_CTL);
+            return -1;
+        }
 
-                ret = -1;
-                break;
-            }
+        ctl |= (*p & 0x7f) << (7 * i);
 
-            free(line);
+        if (!(*p & 0x80))
+        {
+            p++;
+            break;
         }
     }
 
-    // On error print illegal line
-    if (ret == -1)
+    rd->pdu.version = DCHAT_V1;
+    rd->pdu.content_type = begin[1] & FRM_CTT_MASK;
+    rd->pdu.content_length = ctl;
+
+    if (!is_valid_content_type(rd->pdu.content_type) || !is_valid_content_length(ctl))
     {
-        ui_log(LOG_ERR, "Illegal PDU header received: '%s'", line);
+        ui_log(LOG_ERR, "Illegal frame header received!");
+        return -1;
     }
 
-    // EOF or ERROR
-    if (ret <= 0)
+    if (!(begin[1] & FRM_IDENT))
     {
-        free(line);
-        return ret;
+        if (!rd->lport)
+        {
+            ui_log(LOG_ERR, "Frame omits unknown identity of sender!");
+            return -1;
+        }
+
+        memcpy(rd->pdu.onion_id, rd->onion_id, sizeof(rd->onion_id));
+        memcpy(rd->pdu.nickname, rd->nickname, sizeof(rd->nickname));
+        rd->pdu.lport = rd->lport;
+        rd->pdu.interned = 1;
     }
+    else
+    {
+        // onion-id, listening port and length of nickname
+        if (end - p < ONION_ADDRLEN + 3)
+        {
+            return PDU_AGAIN;
+        }
+
+        memcpy(rd->pdu.onion_id, p, ONION_ADDRLEN);
+        rd->pdu.onion_id[ONION_ADDRLEN] = '\0';
+        p += ONION_ADDRLEN;
+        rd->pdu.lport = p[0] << 8 | p[1];
+        p += 2;
+
+        // nickname and length of server
+        if ((len = *p++) > MAX_NICKNAME || end - p < len + 1)
+        {
+            if (len > MAX_NICKNAME)
+            {
+                ui_log(LOG_ERR, "Nickname of frame exceeds %d bytes!", MAX_NICKNAME);
+                return -1;
+            }
+
+            return PDU_AGAIN;
+        }
+
+        memcpy(rd->pdu.nickname, p, len);
+        rd->pdu.nickname[len] = '\0';
+        p += len;
+
+        // server
+        len = *p++;
+
+        if (end - p < len)
+        {
+            return PDU_AGAIN;
+        }
+
+        if (!is_valid_onion(rd->pdu.onion_id) || !is_valid_port(rd->pdu.lport) ||
+            (rd->pdu.nickname[0] && !is_valid_nickname(rd->pdu.nickname)))
+        {
+            ui_log(LOG_ERR, "Illegal identity in frame header received!");
+            return -1;
+        }
+
+        if ((rd->pdu.server = malloc(len + 1)) == NULL)
+        {
+            ui_fatal("Memory allocation for server failed!");
+        }
 
-    // has content type, onion-id and listen-port been specified?
-    if (pdu->content_type == 0 || pdu->onion_id == NULL || pdu->lport == 0)
+        memcpy(rd->pdu.server, p, len);
+        rd->pdu.server[len] = '\0';
+        p += len;
+        // intern identity for the following frames
+        memcpy(rd->onion_id, rd->pdu.onion_id, sizeof(rd->onion_id));
+        memcpy(rd->nickname, rd->pdu.nickname, sizeof(rd->nickname));
+        rd->lport = rd->pdu.lport;
+    }
+
+    rd->off += p - begin;
+    rd->pdu_len += p - begin;
+    return 0;
+}
+
+
+/**
+ *  Prepares the reader for the content of a PDU whose headers are parsed.
+ *  Content exceeding the limit of its content-type is refused. Content of
+ *  at least STREAM_MIN bytes is streamed, if the content-type has a
+ *  consumer, so that it is never buffered completely.
+ *  @see content_limit()
+ *  @param rd Pointer to the reader of the connection
+ *  @return 0 on success, -1 if the content is too long
+ */
+int
+begin_content(pdu_reader_t* rd)
+{
+    const dchat_content_type_t* ctt; // content-type of the PDU
+    int limit = content_limit(rd->pdu.content_type);
+
+    if (rd->pdu.content_length > limit)
     {
-        ui_log(LOG_ERR, "Mandatory PDU headers are missing!");
-        free(line);
+        ui_log(LOG_ERR, "Content-Length %d exceeds limit of %d bytes!",
+               rd->pdu.content_length, limit);
         return -1;
     }
 
-    // allocate memory for content
-    pdu->content = malloc(pdu->content_length + 1);
-    contentp = pdu->content; // point to the beginning
+    ctt = find_content_type(rd->pdu.content_type);
+    rd->state = ctt != NULL && ctt->consume != NULL &&
+                rd->pdu.content_length >= STREAM_MIN ? RD_STATE_STREAM : RD_STATE_CONTENT;
+    return 0;
+}
+
 
-    // read content frm file descriptor
-    // read x bytes defined by Content-Length
-    for (b = 0, contentp = pdu->content; b < pdu->content_length;
-         b++, contentp++, len++)
+/**
+ *  Parses the next DChat PDU out of the receive buffer of a connection.
+ *  This function never reads from a file descriptor. It continues parsing
+ *  where the last call stopped, so that the state of a partially received
+ *  version line, header block or content is kept between calls. Once a PDU
+ *  is complete it will be handed over to the caller and the reader is reset
+ *  for the next one. PDUs starting with FRM_VERSION are binary frames.
+ *  Streamed content is passed to the consumer of the content-type as it
+ *  arrives, the completed PDU holds no content then.
+ *  @see decode_frame_header()
+ *  @see begin_content()
+ *  @param rd  Pointer to the reader of the connection
+ *  @param pdu Pointer to a PDU structure which will be filled with the
+ *             completed PDU
+ *  @return amount of bytes of the completed PDU, PDU_AGAIN if more data is
+ *  required or -1 on error
+ */
+int
+next_pdu(pdu_reader_t* rd, dchat_pdu_t* pdu)
+{
+    char* line;     // header line within the receive buffer
+    char* end;      // end of header line (\n)
+    char c;         // byte following the header line
+    int len;        // length of streamed chunk
+    int ret;        // return value
+
+    for (;;)
     {
-        if ((ret = read(fd, contentp, 1)) == -1 || !ret)
+        if (rd->state == RD_STATE_STREAM)
         {
-            free(pdu->content);
+            // pass buffered content to the consumer, it is discarded
+            // from the receive buffer with the next read
+            len = rd->pdu.content_length - rd->pdu.streamed;
+            len = len < rd->len - rd->off ? len : rd->len - rd->off;
+
+            if (len == 0)
+            {
+                return PDU_AGAIN;
+            }
+
+            if (find_content_type(rd->pdu.content_type)->consume(&rd->pdu,
+                    rd->buf + rd->off, len) == -1)
+            {
+                ui_log(LOG_ERR, "Consumer refused streamed content!");
+                break;
+            }
+
+            rd->off += len;
+            rd->pdu.streamed += len;
+
+            if (rd->pdu.streamed < rd->pdu.content_length)
+            {
+                return PDU_AGAIN;
+            }
+
+            // hand over PDU without content
+            ret = rd->pdu_len + rd->pdu.content_length;
+            memcpy(pdu, &rd->pdu, sizeof(*pdu));
+            memset(&rd->pdu, 0, sizeof(rd->pdu));
+            rd->state = RD_STATE_VERSION;
+            rd->pdu_len = 0;
+            return ret;
+        }
+
+        if (rd->state == RD_STATE_CONTENT)
+        {
+            // wait until x bytes defined by Content-Length are buffered
+            if (rd->len - rd->off < rd->pdu.content_length)
+            {
+                return PDU_AGAIN;
+            }
+
+            // allocate memory for content
+            if ((rd->pdu.content = malloc(rd->pdu.content_length + 1)) == NULL)
+            {
+                ui_fatal("Memory allocation for PDU content failed!");
+            }
+
+            memcpy(rd->pdu.content, rd->buf + rd->off, rd->pdu.content_length);
+            // NULL terminate potential string
+            rd->pdu.content[rd->pdu.content_length] = '\0';
+            rd->off += rd->pdu.content_length;
+            ret = rd->pdu_len + rd->pdu.content_length;
+            // hand over PDU and reset reader for the next one
+            memcpy(pdu, &rd->pdu, sizeof(*pdu));
+            memset(&rd->pdu, 0, sizeof(rd->pdu));
+            rd->state = RD_STATE_VERSION;
+            rd->pdu_len = 0;
             return ret;
         }
+
+        // binary frames are told apart by their first byte
+        if (rd->state == RD_STATE_VERSION && rd->off < rd->len &&
+            (unsigned char) rd->buf[rd->off] == FRM_VERSION)
+        {
+            if ((ret = decode_frame_header(rd)) == PDU_AGAIN)
+            {
+                return PDU_AGAIN;
+            }
+
+            if (ret == -1 || begin_content(rd) == -1)
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        // wait for more data, if there is no complete line buffered
+        if (rd->buf == NULL ||
+            (end = memchr(rd->buf + rd->off, '\n', rd->len - rd->off)) == NULL)
+        {
+            if (rd->len - rd->off > MAX_HEADER_LEN)
+            {
+                ui_log(LOG_ERR, "PDU header line exceeds %d bytes!", MAX_HEADER_LEN);
+                break;
+            }
+
+            return PDU_AGAIN;
+        }
+
+        // temporarily terminate line after \n
+        line = rd->buf + rd->off;
+        c = end[1];
+        end[1] = '\0';
+        ret = decode_header(&rd->pdu, line, end - line + 1);
+
+        // first header must be version header
+        if (rd->state == RD_STATE_VERSION)
+        {
+            if (ret == -1 || rd->pdu.version != DCHAT_V1)
+            {
+                ret = -1;
+            }
+            else
+            {
+                rd->state = RD_STATE_HEADER;
+            }
+        }
+        // if line is not a header, it must be an empty line
+        else if (ret == -1 && (!strcmp(line, "\n") || !strcmp(line, "\r\n")))
+        {
+            rd->state = RD_STATE_CONTENT;
+            ret = 0;
+        }
+
+        // On error print illegal line
+        if (ret == -1)
+        {
+            ui_log(LOG_ERR, "Illegal PDU header received: '%s'", line);
+        }
+
+        end[1] = c;
+        rd->off += end - line + 1;
+        rd->pdu_len += end - line + 1;
+
+        if (ret == -1)
+        {
+            break;
+        }
+
+        // PDUs in session mode omit the identity of the sender, a
+        // changed nickname is sent nevertheless
+        if (rd->state == RD_STATE_CONTENT && rd->lport &&
+            rd->pdu.onion_id[0] == '\0' && !rd->pdu.lport)
+        {
+            memcpy(rd->pdu.onion_id, rd->onion_id, sizeof(rd->onion_id));
+            rd->pdu.lport = rd->lport;
+
+            if (rd->pdu.nickname[0] == '\0')
+            {
+                memcpy(rd->pdu.nickname, rd->nickname, sizeof(rd->nickname));
+                rd->pdu.interned = 1;
+            }
+        }
+
+        // All headers have been read
+        // has content type, onion-id and listen-port been specified?
+        if (rd->state == RD_STATE_CONTENT &&
+            (rd->pdu.content_type == 0 || rd->pdu.onion_id[0] == '\0' ||
+             rd->pdu.lport == 0))
+        {
+            ui_log(LOG_ERR, "Mandatory PDU headers are missing!");
+            break;
+        }
+
+        // intern identity for PDUs which omit it
+        if (rd->state == RD_STATE_CONTENT && !rd->pdu.interned)
+        {
+            memcpy(rd->onion_id, rd->pdu.onion_id, sizeof(rd->onion_id));
+            memcpy(rd->nickname, rd->pdu.nickname, sizeof(rd->nickname));
+            rd->lport = rd->pdu.lport;
+        }
+
+        // check content-length against the limit of the content-type
+        if (rd->state == RD_STATE_CONTENT && begin_content(rd) == -1)
+        {
+            break;
+        }
+    }
+
+    // discard partially parsed PDU on error
+    free_pdu(&rd->pdu);
+    memset(&rd->pdu, 0, sizeof(rd->pdu));
+    rd->state = RD_STATE_VERSION;
+    rd->pdu_len = 0;
+    return -1;
+}
+
+
+/**
+ *  Read a DChat PDU from a file descriptor.
+ *  If the receive buffer of the connection does not hold a complete PDU yet,
+ *  at most one chunk of data will be received from the file descriptor before
+ *  parsing is resumed. Therefore this function does not block on non-blocking
+ *  file descriptors, even if the remote client sends only parts of a PDU.
+ *  @see next_pdu()
+ *  @param fd  File descriptor to read from
+ *  @param rd  Pointer to the reader of the connection
+ *  @param pdu Pointer to a PDU structure whose headers will be filled.
+ *  @return amount of bytes read in total if a protocol data unit has been read successfully, 0 on EOF,
+ *  PDU_AGAIN if the PDU is not complete yet, -1 on error
+ */
+int
+read_pdu(int fd, pdu_reader_t* rd, dchat_pdu_t* pdu)
+{
+    int ret;    // return value
+
+    if ((ret = next_pdu(rd, pdu)) != PDU_AGAIN)
+    {
+        return ret;
+    }
+
+    if ((ret = fill_reader(fd, rd)) <= 0)
+    {
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return PDU_AGAIN;
+        }
+
+        return ret;
     }
 
-    *contentp = '\0'; // NULL terminate potential string
-    return len; // amount of bytes read as content == content length
+    return next_pdu(rd, pdu);
 }
 
 
 /**
- *  Crafts a DChat header string.
- *  Crafts a header string according to the given header_id (see: dchat_encoder.h) together
- *  with the header information stored in the PDU structure.
+ *  Crafts a DChat header line.
+ *  Crafts a header line according to the given header_id (see: dchat_encoder.h) together
+ *  with the header information stored in the PDU structure. The line is written
+ *  into the given buffer, thus no memory will be allocated.
  *  @param pdu       Pointer to a message structure that holds header information like
  *                   Content-Type, Content-Length, ...
  *  @param header_id Defines for which header a string should be crafted (Content-Type, ...)
- *  @return  Pointer to a header string (stored on heap -> must be freed) or NULL on error
- *           This string is not terminated with \\n or \\r\\n respectively
+ *  @param buf       Buffer where the header line will be written to
+ *  @param size      Size of the buffer
+ *  @return Amount of bytes written (the line is terminated with \n, but not with \0),
+ *          0 if an optional header has not been set in the PDU or -1 on error
  */
 int
-encode_header(dchat_pdu_t* pdu, int header_id, char** headerline)
+encode_header(dchat_pdu_t* pdu, int header_id, char* buf, int size)
 {
-    dchat_v1_t proto;    // DChat V1 headers
-    char* header = NULL; // header key string
-    char* value  = NULL; // header value string
-    int len;             // length of string in total
+    const dchat_header_t* hdr; // DChat V1 header
+    int len;                   // length of header key
     int ret;
 
-    if (init_dchat_v1(&proto) == -1)
+    if ((hdr = find_header_by_id(header_id)) == NULL)
+    {
+        return -1;
+    }
+
+    len = strlen(hdr->header_name);
+
+    // key, ": " and '\n' have to fit into the buffer
+    if (size < len + 3)
+    {
+        return -1;
+    }
+
+    // assemble header line -> "key: value\n"
+    memcpy(buf, hdr->header_name, len);
+    buf[len] = ':';
+    buf[len + 1] = ' ';
+
+    if ((ret = hdr->pdu_to_str(pdu, buf + len + 2, size - len - 3)) == -1)
+    {
+        return -1;
+    }
+
+    // check if header is mandatory, if no value has been set
+    // in the pdu structure
+    if (ret == 0)
+    {
+        // if header is mandatory -> raise error
+        // otherwise just return and do nothing
+        return hdr->mandatory ? -1 : 0;
+    }
+
+    buf[len + 2 + ret] = '\n';
+    return len + 3 + ret;
+}
+
+
+/**
+ * Crafts the header block of a PDU.
+ * All headers set in the PDU are written into the given buffer, beginning with
+ * the version header and followed by the empty line which separates headers from
+ * the content. In session mode the headers describing the sender are left out,
+ * the receiver uses the identity it has interned from the first PDU instead.
+ * @param pdu   Pointer to a PDU structure holding the header data
+ * @param ident Include the headers describing the sender?
+ * @param buf   Buffer where the header block will be written to
+ * @param size Size of the buffer
+ * @return Length of the header block or -1 in case of error
+ */
+int
+encode_pdu_header(dchat_pdu_t* pdu, int ident, char* buf, int size)
+{
+    int len;           // Length of header block
+    int ret;           // Return value
+
+    // version header is always the first header
+    if ((len = encode_header(pdu, HDR_ID_VER, buf, size)) <= 0)
     {
         return -1;
     }
@@ -315,159 +823,184 @@ encode_header(dchat_pdu_t* pdu, int header_id, char** headerline)
     // iterate through supported headers
     for (int i = 0; i < HDR_AMOUNT; i++)
     {
-        if (proto.header[i].header_id == header_id)
+        // get header strings except version header, if set in pdu structure
+        if (_proto_v1.header[i].header_id != HDR_ID_VER &&
+            (ident || !HDR_IS_IDENT(_proto_v1.header[i].header_id)))
         {
-            header = proto.header[i].header_name;
-            len = strlen(header);
-
-            if ((ret = proto.header[i].pdu_to_str(pdu, &value)) == -1)
+            if ((ret = encode_header(pdu, _proto_v1.header[i].header_id, buf + len,
+                                     size - len)) == -1)
             {
                 return -1;
             }
 
-            // check if header is mandatory, if no value has been set
-            // in the pdu structure
-            if (ret == 1)
-            {
-                // if header is mandatory -> raise error
-                // otherwise just return and do nothing
-                if (proto.header[i].mandatory)
-                {
-                    return -1;
-                }
-
-                return 1;
-            }
-
-            len += strlen(value);
-            len += 4; // add three bytes for ':', a " ", '\n' and '\0';
-
-            // allocate memory for header string
-            if ((*headerline = malloc(len)) == NULL)
-            {
-                ui_fatal("Memory allocation for header-value string failed!");
-            }
-
-            // assemble header string
-            *headerline[0] = '\0';
-            strncat(*headerline, header, strlen(header));
-            strncat(*headerline, ":", 1); // seperate key from value -> "key:value"
-            strncat(*headerline, " ", 1); // add a " " after the semicolon -> "key: value"
-            strncat(*headerline, value, strlen(value)); // add value
-            strncat(*headerline, "\n", 1);
-            // free converted pdu structure value
-            free(value);
-            return 0;
+            len += ret;
         }
     }
 
-    return -1;
+    // add empty line
+    if (len >= size)
+    {
+        return -1;
+    }
+
+    buf[len++] = '\n';
+    return len;
 }
 
 
 /**
- * Converts a PDU to a string that will be written to a file descriptor.
- * Converts the given PDU to string which then will be written to the given file descriptor.
- * First the headers of the PDU will be written, then an empty line and at last the content.
- * (See specification of the dchat protocol)
- * @param fd  File descriptor where the dchat PDU will be written to
- * @param pdu Pointer to a PDU structure holding the header and content data
- * @return Amount of bytes of content that that have been written. This should be equal
- *         to the value defined in the attribute "content_length" of the given PDU structure
- *         or -1 in case of error
+ * Crafts the header of a binary frame.
+ * The identity of the sender is included only if requested, the receiver
+ * uses the identity it has interned from the last PDU otherwise.
+ * @see decode_frame_header()
+ * @param pdu   Pointer to a PDU structure holding the header data
+ * @param ident Include onion-id, listening port, nickname and server?
+ * @param buf   Buffer where the frame header will be written to
+ * @param size  Size of the buffer
+ * @return Length of the frame header or -1 in case of error
  */
 int
-write_pdu(int fd, dchat_pdu_t* pdu)
+encode_frame_header(dchat_pdu_t* pdu, int ident, char* buf, int size)
 {
-    dchat_v1_t proto;                //Available DChat headers
-    char* header;                    //DChat header
-    char* pdu_raw;                   //Final PDU
-    int ret;                         //Return value
-    int pdulen=1;                    //Total length of PDU
+    unsigned char* p = (unsigned char*) buf; // write position
+    int ctl = pdu->content_length;           // remaining content-length
+    int nick_len = strlen(pdu->nickname);    // length of nickname
+    int srv_len = pdu->server != NULL ? strlen(pdu->server) : 0; // length of server
 
-    if (init_dchat_v1(&proto) == -1)
+    if (size < 2 + FRM_MAX_CTL + (ident ? ONION_ADDRLEN + 4 + nick_len + srv_len : 0) ||
+        !is_valid_content_length(ctl) || srv_len > 255)
     {
         return -1;
     }
 
-    // get version header string
-    if ((ret = encode_header(pdu, HDR_ID_VER, &header)) == -1 || ret == 1)
+    *p++ = FRM_VERSION;
+    *p++ = pdu->content_type | (ident ? FRM_IDENT : 0);
+
+    // content-length as varint
+    for (; ctl >= 0x80; ctl >>= 7)
     {
-        return -1;
+        *p++ = (ctl & 0x7f) | 0x80;
     }
 
-    pdulen += strlen(header);
+    *p++ = ctl;
 
-    if ((pdu_raw = malloc(pdulen)) == NULL)
+    if (ident)
     {
-        ui_fatal("Memory allocation for pdu failed!");
+        memcpy(p, pdu->onion_id, ONION_ADDRLEN);
+        p += ONION_ADDRLEN;
+        *p++ = pdu->lport >> 8;
+        *p++ = pdu->lport & 0xff;
+        *p++ = nick_len;
+        memcpy(p, pdu->nickname, nick_len);
+        p += nick_len;
+        *p++ = srv_len;
+        memcpy(p, pdu->server, srv_len);
+        p += srv_len;
     }
 
-    // copy version header to raw pdu
-    pdu_raw[0] = '\0';
-    strcat(pdu_raw, header);
-    free(header);
+    return p - (unsigned char*) buf;
+}
 
-    // iterate through supported headers
-    for (int i = 0; i < HDR_AMOUNT; i++)
-    {
-        // get header strings except version header, if set in pdu structure
-        if (proto.header[i].header_id != HDR_ID_VER)
-        {
-            // get header string
-            if ((ret = encode_header(pdu, proto.header[i].header_id, &header)) == -1)
-            {
-                free(pdu_raw);
-                return -1;
-            }
 
-            // if header was mandatory, but value was not set in pdu structure
-            // raise an error
-            if (ret == 1)
-            {
-                if (proto.header[i].mandatory)
-                {
-                    free(pdu_raw);
-                    return -1;
-                }
+/**
+ * Creates a wire buffer out of an encoded header and the content of a PDU.
+ * The returned buffer holds one reference which must be released by the
+ * caller.
+ * @see release_wire_buf()
+ * @param header Encoded header block or frame header
+ * @param len    Length of the header
+ * @param pdu    Pointer to a PDU structure holding the content
+ * @return Pointer to the wire buffer
+ */
+wire_buf_t*
+new_wire_buf(char* header, int len, dchat_pdu_t* pdu)
+{
+    wire_buf_t* wb; // encoded PDU
 
-                continue;
-            }
+    if ((wb = malloc(sizeof(*wb) + len + pdu->content_length)) == NULL)
+    {
+        ui_fatal("Memory allocation for wire buffer failed!");
+    }
 
-            // (re)allocate memory for new header (excluding \0)
-            pdulen += strlen(header);
-            pdu_raw = realloc(pdu_raw, pdulen);
+    wb->refs = 1;
+    wb->len  = len + pdu->content_length;
+    memcpy(wb->data, header, len);
+    memcpy(wb->data + len, pdu->content, pdu->content_length);
+    return wb;
+}
 
-            if (pdu_raw == NULL)
-            {
-                ui_fatal("Reallocation of pdu failed!");
-            }
 
-            // copy header to pdu
-            strcat(pdu_raw, header);
-            free(header);
-        }
+/**
+ * Encodes a PDU into a wire buffer.
+ * The PDU is serialized once, so that the resulting buffer can be queued
+ * for any amount of contacts. The returned buffer holds one reference
+ * which must be released by the caller.
+ * @see release_wire_buf()
+ * @param pdu   Pointer to a PDU structure holding the header and content data
+ * @param ident Include the headers describing the sender?
+ * @return Pointer to the wire buffer or NULL in case of error
+ */
+wire_buf_t*
+encode_pdu(dchat_pdu_t* pdu, int ident)
+{
+    char header[MAX_HEADER_BLOCK];  // Header block
+    int len;                        // Length of header block
+
+    if ((len = encode_pdu_header(pdu, ident, header, sizeof(header))) == -1)
+    {
+        return NULL;
     }
 
-    // (re)allocate memory for empty line and content
-    pdulen += pdu->content_length + 1;
-    pdu_raw = realloc(pdu_raw, pdulen);
+    return new_wire_buf(header, len, pdu);
+}
+
+
+/**
+ * Encodes a PDU into a wire buffer holding a binary frame.
+ * Only contacts which announced CAP_FRAME can decode it.
+ * @see encode_frame_header()
+ * @param pdu   Pointer to a PDU structure holding the header and content data
+ * @param ident Include the identity of the sender?
+ * @return Pointer to the wire buffer or NULL in case of error
+ */
+wire_buf_t*
+encode_frame(dchat_pdu_t* pdu, int ident)
+{
+    char header[MAX_HEADER_BLOCK];  // Frame header
+    int len;                        // Length of frame header
 
-    if (pdu_raw == NULL)
+    if ((len = encode_frame_header(pdu, ident, header, sizeof(header))) == -1)
     {
-        ui_fatal("Reallocation of pdu failed!");
+        return NULL;
     }
 
-    // add empty line
-    strcat(pdu_raw, "\n");
-    // add content
-    strncat(pdu_raw, pdu->content, pdu->content_length);
-    // exclude \0
-    pdulen--;
-    //write pdu to file descriptor
-    ret = write(fd, pdu_raw, strlen(pdu_raw));
-    free(pdu_raw);
-    return pdulen;
+    return new_wire_buf(header, len, pdu);
+}
+
+
+/**
+ * Acquires an additional reference of a wire buffer.
+ * @param wb Pointer to wire buffer
+ */
+void
+hold_wire_buf(wire_buf_t* wb)
+{
+    __sync_add_and_fetch(&wb->refs, 1);
+}
+
+
+/**
+ * Releases a reference of a wire buffer.
+ * The buffer will be freed if this has been the last reference.
+ * @param wb Pointer to wire buffer
+ */
+void
+release_wire_buf(wire_buf_t* wb)
+{
+    if (__sync_sub_and_fetch(&wb->refs, 1) == 0)
+    {
+        free(wb);
+    }
 }
 
 
@@ -503,24 +1036,16 @@ ver_str_to_pdu(char* value, dchat_pdu_t* pdu)
 int
 ctt_str_to_pdu(char* value, dchat_pdu_t* pdu)
 {
-    int found = 0;
-    dchat_content_types_t ctt;
-
-    if (init_dchat_content_types(&ctt) == -1)
-    {
-        return -1;
-    }
-
     for (int i = 0; i < CTT_AMOUNT; i++)
     {
-        if (!strcmp(value, ctt.type[i].ctt_name))
+        if (!strcmp(value, _ctt_v1.type[i].ctt_name))
         {
-            pdu->content_type = ctt.type[i].ctt_id;
-            found = 1;
+            pdu->content_type = _ctt_v1.type[i].ctt_id;
+            return 0;
         }
     }
 
-    return found ? 0 : -1;
+    return -1;
 }
 
 
@@ -672,37 +1197,29 @@ srv_str_to_pdu(char* value, dchat_pdu_t* pdu)
 
 
 /**
- * Converts the version field in the PDU to a string and sets the address of the given
- * value parameter to this string.
+ * Converts the version field in the PDU to a string and writes it into
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer for the string
+ * @param size Size of the buffer
+ * @return length of the string on success, 0 if the field was not set in pdu structure,
+ * -1 in case of error (e.g. illegal value in pdu structure, buffer too small, ...)
  */
 int
-ver_pdu_to_str(dchat_pdu_t* pdu, char** value)
+ver_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
     char* version = "1.0";
 
     // nothing has been set
     if (pdu->version == 0)
     {
-        return 1;
+        return 0;
     }
 
     // if version is V1
     if (pdu->version == DCHAT_V1)
     {
-        *value = malloc(strlen(version) + 1);
-
-        if (*value == NULL)
-        {
-            ui_fatal("Memory allocation for version failed!");
-        }
-
-        *value[0] = '\0';
-        strcat(*value, version);
-        return 0;
+        return copy_value(value, size, version);
     }
 
     return -1;
@@ -710,47 +1227,29 @@ ver_pdu_to_str(dchat_pdu_t* pdu, char** value)
 
 
 /**
- * Converts the content-type field in the PDU to a string and sets the
- * address of the given value parameter to this string.
+ * Converts the content-type field in the PDU to a string and writes it into
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer for the string
+ * @param size Size of the buffer
+ * @return length of the string on success, 0 if the field was not set in pdu structure,
+ * -1 in case of error (e.g. illegal value in pdu structure, buffer too small, ...)
  */
 int
-ctt_pdu_to_str(dchat_pdu_t* pdu, char** value)
+ctt_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    dchat_content_types_t content_types;
-    char* type;
-
     // content type has not been set
     if (pdu->content_type == 0)
     {
-        return 1;
-    }
-
-    // init available content types
-    if (init_dchat_content_types(&content_types) == -1)
-    {
-        return -1;
+        return 0;
     }
 
     // iterate through content-types and build a content type string
     for (int i = 0; i < CTT_AMOUNT; i++)
     {
-        if (content_types.type[i].ctt_id == pdu->content_type)
+        if (_ctt_v1.type[i].ctt_id == pdu->content_type)
         {
-            type = content_types.type[i].ctt_name;
-            *value = malloc(strlen(type) + 1);
-
-            if (*value == NULL)
-            {
-                ui_fatal("Memory allocation for content-type failed!");
-            }
-
-            *value[0] = '\0';
-            strncat(*value, type, strlen(type));
-            return 0;
+            return copy_value(value, size, _ctt_v1.type[i].ctt_name);
         }
     }
 
@@ -759,49 +1258,46 @@ ctt_pdu_to_str(dchat_pdu_t* pdu, char** value)
 
 
 /**
- * Converts the content-length field in the PDU to a string and sets the
- * address of the given value parameter to this string.
+ * Converts the content-length field in the PDU to a string and writes it into
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer for the string
+ * @param size Size of the buffer
+ * @return length of the string on success, 0 if the field was not set in pdu structure,
+ * -1 in case of error (e.g. illegal value in pdu structure, buffer too small, ...)
  */
 int
-ctl_pdu_to_str(dchat_pdu_t* pdu, char** value)
+ctl_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
+    int ret;
+
     // check if content-length is valid
     if (!is_valid_content_length(pdu->content_length))
     {
         return -1;
     }
 
-    *value = malloc(MAX_INT_STR + 1);
-
-    if (*value == NULL)
-    {
-        ui_fatal("Memory allocation for content-length failed!");
-    }
-
-    snprintf(*value, MAX_INT_STR, "%d", pdu->content_length);
-    return 0;
+    ret = snprintf(value, size, "%d", pdu->content_length);
+    return ret < size ? ret : -1;
 }
 
 
 /**
- * Converts the onion-id field in the PDU to a string and sets the
- * address of the given value parameter to this string.
+ * Converts the onion-id field in the PDU to a string and writes it into
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer for the string
+ * @param size Size of the buffer
+ * @return length of the string on success, 0 if the field was not set in pdu structure,
+ * -1 in case of error (e.g. illegal value in pdu structure, buffer too small, ...)
  */
 int
-oni_pdu_to_str(dchat_pdu_t* pdu, char** value)
+oni_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
     // no onion-id has been set
     if (pdu->onion_id[0] == '\0')
     {
-        return 1;
+        return 0;
     }
 
     // check if set onion id is valid
@@ -810,35 +1306,28 @@ oni_pdu_to_str(dchat_pdu_t* pdu, char** value)
         return -1;
     }
 
-    //copy onion id
-    *value = malloc(strlen(pdu->onion_id) + 1);
-
-    if (*value == NULL)
-    {
-        ui_fatal("Memory allocation for onion-id failed!");
-    }
-
-    *value[0] = '\0';
-    strcat(*value, pdu->onion_id);
-    return 0;
+    return copy_value(value, size, pdu->onion_id);
 }
 
 
 /**
- * Converts the listening-port field in the PDU to a string and sets the
- * address of the given value parameter to this string.
+ * Converts the listening-port field in the PDU to a string and writes it into
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer for the string
+ * @param size Size of the buffer
+ * @return length of the string on success, 0 if the field was not set in pdu structure,
+ * -1 in case of error (e.g. illegal value in pdu structure, buffer too small, ...)
  */
 int
-lnp_pdu_to_str(dchat_pdu_t* pdu, char** value)
+lnp_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
+    int ret;
+
     // listening port has not been specified
     if (pdu->lport == 0)
     {
-        return 1;
+        return 0;
     }
 
     // check if listening port is valid
@@ -847,32 +1336,26 @@ lnp_pdu_to_str(dchat_pdu_t* pdu, char** value)
         return -1;
     }
 
-    *value = malloc(MAX_INT_STR + 1);
-
-    if (*value == NULL)
-    {
-        ui_fatal("Memory allocation for listening-port failed!");
-    }
-
-    snprintf(*value, MAX_INT_STR, "%d", pdu->lport);
-    return 0;
+    ret = snprintf(value, size, "%d", pdu->lport);
+    return ret < size ? ret : -1;
 }
 
 
 /**
- * Converts the nickname field in the PDU to a string and sets the
- * address of the given value parameter to this string.
+ * Converts the nickname field in the PDU to a string and writes it into
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer for the string
+ * @param size Size of the buffer
+ * @return length of the string on success, 0 if the field was not set in pdu structure,
+ * -1 in case of error (e.g. illegal value in pdu structure, buffer too small, ...)
  */
 int
-nic_pdu_to_str(dchat_pdu_t* pdu, char** value)
+nic_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
     if (pdu->nickname[0] == '\0')
     {
-        return 1;
+        return 0;
     }
 
     if (!is_valid_nickname(pdu->nickname))
@@ -880,152 +1363,53 @@ nic_pdu_to_str(dchat_pdu_t* pdu, char** value)
         return -1;
     }
 
-    //copy nickname
-    *value = malloc(strlen(pdu->nickname) + 1);
-
-    if (*value == NULL)
-    {
-        ui_fatal("Memory allocation for nickname failed!");
-    }
-
-    *value[0] = '\0';
-    strcat(*value, pdu->nickname);
-    return 0;
+    return copy_value(value, size, pdu->nickname);
 }
 
 
 /**
- * Converts the sent field in the PDU to a string and sets the
- * address of the given value parameter to this string.
+ * Converts the sent field in the PDU to a string and writes it into
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
+ * @param value Buffer for the string
+ * @param size Size of the buffer
+ * @return length of the string on success, 0 if the field was not set in pdu structure,
+ * -1 in case of error (e.g. illegal value in pdu structure, buffer too small, ...)
  */
 int
-dat_pdu_to_str(dchat_pdu_t* pdu, char** value)
+dat_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    int max_len = 100;
+    int ret;
 
     // check if date field is empty
     if (iszero(&pdu->sent, sizeof(pdu->sent)))
     {
-        return 1;
-    }
-
-    *value = malloc(max_len);
-
-    if (*value == NULL)
-    {
-        ui_fatal("Memory allocation for date failed!");
+        return 0;
     }
 
-    *value[0] = '\0';
-    strftime(*value, max_len, "%a, %d %b %Y %H:%M:%S GMT", &pdu->sent);
-    return 0;
+    ret = strftime(value, size, "%a, %d %b %Y %H:%M:%S GMT", &pdu->sent);
+    return ret > 0 ? ret : -1;
 }
 
 
 /**
- * Converts the server field in the PDU to a string and sets the
- * address of the given value parameter to this string.
+ * Converts the server field in the PDU to a string and writes it into
+ * the given buffer.
  * @param pdu Pointer to PDU structure
- * @param value Double pointer to string
- * @return 1 field was not set in pdu structure, 0 on success (string must be freed),
- * -1 in case of error (e.g. illegal value in pdu structure , ...)
- */
-int
-srv_pdu_to_str(dchat_pdu_t* pdu, char** value)
-{
-    if (pdu->server == NULL)
-    {
-        return 1;
-    }
-
-    *value = malloc(strlen(pdu->server) + 1);
-
-    if (*value == NULL)
-    {
-        ui_fatal("Memory allocation for date failed!");
-    }
-
-    *value[0] = '\0';
-    strcat(*value, pdu->server);
-    return 0;
-}
-
-
-/**
- * Initializes a content-types structure with all available
- * content-types in DChat.
- * The structure the given Pointer is pointing to, will be
- * initialized with all content-types supported by DChat (e.g
- * "text/plain", "control/discover", ...). The name of the
- * content-type will be set, as well as its ID.
- * @param ctt Pointer to content-types structure to initialize
- * @return Initialized content-types structure.
- */
-int
-init_dchat_content_types(dchat_content_types_t* ctt)
-{
-    int temp_size;
-    int ctt_size;
-    dchat_content_type_t temp[] =
-    {
-        CONTENT_TYPE(CTT_ID_TXT, CTT_NAME_TXT),
-        CONTENT_TYPE(CTT_ID_BIN, CTT_NAME_BIN),
-        CONTENT_TYPE(CTT_ID_DSC, CTT_NAME_DSC),
-        CONTENT_TYPE(CTT_ID_RPY, CTT_NAME_RPY),
-    };
-    temp_size = sizeof(temp) / sizeof(temp[0]);
-
-    if (temp_size > CTT_AMOUNT)
-    {
-        return -1;
-    }
-
-    memset(ctt, 0, sizeof(*ctt));
-    memcpy(ctt->type, &temp, sizeof(temp));
-    return 0;
-}
-
-
-/**
- * Initializes a DChat V1 structure containing all available and
- * supported headers of the DChat V1 protocol.
- * The given structure will be initialized with all headers
- * available. The header IDs and names will be set and function addresses
- * pointing to corresponding value parsers will be set too.
- * @param proto
- * @return 0 if structure has been initialized successfully, -1 otherwise
+ * @param value Buffer for the string
+ * @param size Size of the buffer
+ * @return length of the string on success, 0 if the field was not set in pdu structure,
+ * -1 in case of error (e.g. illegal value in pdu structure, buffer too small, ...)
  */
 int
-init_dchat_v1(dchat_v1_t* proto)
+srv_pdu_to_str(dchat_pdu_t* pdu, char* value, int size)
 {
-    int temp_size;
-    int proto_size;
-    // available headers
-    dchat_header_t temp[] =
-    {
-        HEADER(HDR_ID_VER, HDR_NAME_VER, 1, ver_str_to_pdu, ver_pdu_to_str),
-        HEADER(HDR_ID_CTT, HDR_NAME_CTT, 1, ctt_str_to_pdu, ctt_pdu_to_str),
-        HEADER(HDR_ID_CTL, HDR_NAME_CTL, 1, ctl_str_to_pdu, ctl_pdu_to_str),
-        HEADER(HDR_ID_ONI, HDR_NAME_ONI, 1, oni_str_to_pdu, oni_pdu_to_str),
-        HEADER(HDR_ID_LNP, HDR_NAME_LNP, 1, lnp_str_to_pdu, lnp_pdu_to_str),
-        HEADER(HDR_ID_NIC, HDR_NAME_NIC, 0, nic_str_to_pdu, nic_pdu_to_str),
-        HEADER(HDR_ID_DAT, HDR_NAME_DAT, 0, dat_str_to_pdu, dat_pdu_to_str),
-        HEADER(HDR_ID_SRV, HDR_NAME_SRV, 0, srv_str_to_pdu, srv_pdu_to_str)
-    };
-    temp_size = sizeof(temp) / sizeof(temp[0]);
-
-    if (temp_size > HDR_AMOUNT)
+    if (pdu->server == NULL || pdu->server[0] == '\0')
     {
-        return -1;
+        return 0;
     }
 
-    memset(proto, 0, sizeof(*proto));
-    memcpy(proto->header, &temp, sizeof(temp));
-    return 0;
+    return copy_value(value, size, pdu->server);
 }
 
 
@@ -1090,10 +1474,13 @@ init_dchat_pdu(dchat_pdu_t* pdu, float version, int content_type,
     time_t now        = time(0);
     struct tm tm      = *gmtime(&now);
     memcpy(&pdu->sent, &tm, sizeof(struct tm));
-    // set servername
+    // set servername, capabilities are announced as comment
     char* package_name = PACKAGE_NAME;
     char* package_version = PACKAGE_VERSION;
-    pdu->server = malloc(strlen(package_name)+strlen(package_version)+2);
+    char* capabilities = " (" CAP_NAME_DIGEST " " CAP_NAME_BINLIST " " CAP_NAME_FRAME
+                         " " CAP_NAME_SESSION ")";
+    pdu->server = malloc(strlen(package_name) + strlen(package_version) +
+                         strlen(capabilities) + 2);
 
     if (pdu->server == NULL)
     {
@@ -1104,6 +1491,7 @@ init_dchat_pdu(dchat_pdu_t* pdu, float version, int content_type,
     strcat(pdu->server, package_name);
     strcat(pdu->server, "/");
     strcat(pdu->server, package_version);
+    strcat(pdu->server, capabilities);
     return 0;
 }
 
@@ -1179,29 +1567,28 @@ is_valid_termination(char* value)
 
 /**
  * Checks if the given Content-Type number is a valid DChat Content-Type.
+ * Only ids of the content-type table are valid.
+ * @see find_content_type()
  * @return 1 if valid, 0 otherwise.
  */
 int
 is_valid_content_type(int content_type)
 {
-    if (content_type & CTT_MASK_ALL)
-    {
-        return 1;
-    }
-
-    return 0;
+    return find_content_type(content_type) != NULL;
 }
 
 
 /**
  * Checks if the given Content-Length is a valid DChat Content-Length.
- * Content-Length must be between 0 and MAX_CONTENT_LEN.
+ * Content-Length must be between 0 and MAX_CONTENT_HARD, the limit of
+ * the content-type is checked as soon as all headers are known.
+ * @see content_limit()
  * @return 1 if valid, 0 otherwise.
  */
 int
 is_valid_content_length(int ctl)
 {
-    if (ctl >= 0 && ctl <= MAX_CONTENT_LEN)
+    if (ctl >= 0 && ctl <= MAX_CONTENT_HARD)
     {
         return 1;
     }
@@ -1210,6 +1597,69 @@ is_valid_content_length(int ctl)
 }
 
 
+/**
+ * Looks up a content-type by its id.
+ * @param content_type Id of content-type
+ * @return Pointer to the content-type or NULL if there is no such content-type
+ */
+const dchat_content_type_t*
+find_content_type(int content_type)
+{
+    for (int i = 0; i < CTT_AMOUNT; i++)
+    {
+        if (_ctt_v1.type[i].ctt_id == content_type)
+        {
+            return &_ctt_v1.type[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Returns the maximum content-length of a content-type.
+ * Unknown content-types are limited to MAX_CONTENT_LEN.
+ * @param content_type Id of content-type
+ * @return maximum content-length in bytes
+ */
+int
+content_limit(int content_type)
+{
+    const dchat_content_type_t* ctt = find_content_type(content_type);
+
+    return ctt != NULL ? ctt->max_len : MAX_CONTENT_LEN;
+}
+
+
+/**
+ * Sets the maximum content-length of a content-type.
+ * This must be done before any PDU is received.
+ * @param name Name of content-type, e.g. "application/octet"
+ * @param len  Maximum content-length in bytes
+ * @return 0 on success, -1 if the content-type or the length is invalid
+ */
+int
+set_content_limit(char* name, int len)
+{
+    if (!is_valid_content_length(len))
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < CTT_AMOUNT; i++)
+    {
+        if (!strcmp(name, _ctt_v1.type[i].ctt_name))
+        {
+            _ctt_v1.type[i].max_len = len;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+
 /**
  * Checks if the given nickname is a valid DChat nickname.
  * @return 1 if valid, 0 otherwise.
@@ -1235,6 +1685,28 @@ is_valid_nickname(char* nickname)
 }
 
 
+/**
+ * Copies a \0 terminated string into the given buffer.
+ * @param value Buffer for the string
+ * @param size Size of the buffer
+ * @param str String to copy
+ * @return length of the copied string or -1 if the buffer is too small
+ */
+int
+copy_value(char* value, int size, const char* str)
+{
+    int len = strlen(str);
+
+    if (len >= size)
+    {
+        return -1;
+    }
+
+    memcpy(value, str, len + 1);
+    return len;
+}
+
+
 /**
  *  Frees all resources dynamically allocated for a PDU structure.
  *  This function frees the allocated memory for the content. In the
@@ -1260,51 +1732,97 @@ free_pdu(dchat_pdu_t* pdu)
 
 
 /**
- *  Extracts a fraction of the content.
- *  Part of the content of a PDU will be extracted beginning at offset and
- *  ending at the given terminating character term. The partial content, given
- *  as double pointer should be freed after the successfull call of this function.
+ *  Iterates over the lines of the content.
+ *  Yields the next part of the content beginning at offset and ending
+ *  before the terminating character term. Nothing is copied: line points
+ *  into the content of the pdu and is not null-terminated. Offset is
+ *  advanced past the terminating character, hence repeated calls walk the
+ *  content in a single pass.
  *  @param pdu      Pointer to a pdu containing the content
- *  @param offset   Offset where the extraction will begin
- *  @param term     Terminating character where the extraction will end
- *  @param content  Extracted content
- *  @return Returns offset where the terminating character has
- *          been found in the content of the pdu, -1 on error
+ *  @param offset   Offset where the next line begins, will be updated
+ *  @param term     Terminating character of a line
+ *  @param line     Will point to the beginning of the line
+ *  @param len      Will contain the length of the line without term
+ *  @return 1 if a line has been found, 0 if the end of the content
+ *          has been reached, -1 if the last line is unterminated
  */
 int
-get_content_part(dchat_pdu_t* pdu, int offset, char term, char** content)
+next_content_line(dchat_pdu_t* pdu, int* offset, char term, char** line, int* len)
 {
-    int line_end; // detected end of line, represented as index
-    char* ptr;    // content pointer
+    char* begin; // beginning of the line
+    char* end;   // position of the terminating character
 
-    // check if offset is within the content
-    if (offset >= pdu->content_length)
+    if (pdu->content == NULL || *offset >= pdu->content_length)
     {
-        ui_log(LOG_ERR, "Could not extract partial content!");
-        return -1;
+        return 0;
     }
 
-    // determine line end -> \n or end of content
-    for (ptr = (pdu->content + offset), line_end = offset; *ptr != term &&
-         line_end < pdu->content_length; ptr++, line_end++);
+    begin = pdu->content + *offset;
+    end = memchr(begin, term, pdu->content_length - *offset);
 
-    // if end of content is reached before \n
-    if (line_end == pdu->content_length && *(ptr - 1) != term)
+    if (end == NULL)
     {
-        ui_log(LOG_ERR, "Could not extract partial content!");
         return -1;
     }
 
-    // reserve enough space for line + \0
-    *content = malloc(line_end + 2); // +1 since its an index and +1 for \0
+    *line = begin;
+    *len = end - begin;
+    *offset += *len + 1;
+    return 1;
+}
+
+
+/**
+ * Parses the capabilities announced in the value of a Server header.
+ * Capabilities are listed as space separated tokens within parentheses
+ * following the name and version of the server, e.g.
+ * "dchat/1.0 (digest binlist frame session)". Clients which do not announce any capabilities
+ * only support the plain DChat protocol.
+ * @param server Value of the Server header, may be NULL
+ * @return capability flags (CAP_*) of the server
+ */
+int
+parse_capabilities(char* server)
+{
+    int caps = 0; // announced capabilities
+    int len;      // length of a token
+
+    if (server == NULL || (server = strchr(server, '(')) == NULL)
+    {
+        return 0;
+    }
 
-    if (*content == NULL)
+    for (server++; *server != '\0' && *server != ')'; server += len)
     {
-        ui_fatal("Memory allocation for partial content failed!");
+        if (*server == ' ')
+        {
+            len = 1;
+            continue;
+        }
+
+        len = strcspn(server, " )");
+
+        if (len == sizeof(CAP_NAME_DIGEST) - 1 &&
+            !strncmp(server, CAP_NAME_DIGEST, len))
+        {
+            caps |= CAP_DIGEST;
+        }
+        else if (len == sizeof(CAP_NAME_BINLIST) - 1 &&
+                 !strncmp(server, CAP_NAME_BINLIST, len))
+        {
+            caps |= CAP_BINLIST;
+        }
+        else if (len == sizeof(CAP_NAME_FRAME) - 1 &&
+                 !strncmp(server, CAP_NAME_FRAME, len))
+        {
+            caps |= CAP_FRAME;
+        }
+        else if (len == sizeof(CAP_NAME_SESSION) - 1 &&
+                 !strncmp(server, CAP_NAME_SESSION, len))
+        {
+            caps |= CAP_SESSION;
+        }
     }
 
-    // copy data into line buffer
-    strncpy(*content, &pdu->content[offset], (line_end - offset + 1));
-    (*content)[line_end + 1] = '\0';
-    return line_end;
+    return caps;
 }
@@ -31,124 +31,27 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 
 #include "dchat_h/network.h"
 #include "dchat_h/consoleui.h"
 
 
 /**
- * Writes a SOCKS PDU to the given socket.
- * @param s   Socket where the PDU will be written to
- * @param pdu SOCKS PDU that will be written
- * @return 0 on success, -1 in case of error
- */
-int
-write_socks4a(int s, socks4a_pdu_t* pdu)
-{
-    // convert ip and port to network byte order
-    uint16_t rport  = htons(pdu->port);
-    uint32_t fakeip = htonl(pdu->fakeip);
-
-    if (write(s, &pdu->version, 1) == -1)
-    {
-        return -1;
-    }
-    else if (write(s, &pdu->command, 1) == -1)
-    {
-        return -1;
-    }
-    else if (write(s, &rport, 2) == -1)
-    {
-        return -1;
-    }
-    else if (write(s, &fakeip, 4) == -1)
-    {
-        return -1;
-    }
-    else if (write(s, &pdu->delim, 1) == -1)
-    {
-        return -1;
-    }
-    else if (write(s, pdu->hostname, strlen(pdu->hostname)) == -1)
-    {
-        return -1;
-    }
-    else if (write(s, &pdu->delim, 1) == -1)
-    {
-        return -1;
-    }
-
-    return 0;
-}
-
-
-/**
- * Reads a SOCKS response PDU from the given socket.
- * @param s Socket to read from
- * @param
- */
-int
-read_socks4a(int s, socks4a_pdu_t* pdu)
-{
-    int ret;
-
-    // read SOCKS4a response (see SOCKS4a protocol)
-    if ((ret = read(s, pdu, 8)) <= 0)
-    {
-        //return ret;
-    }
-
-    // convert port and ip to host byte order
-    pdu->port   = ntohs(pdu->port);
-    pdu->fakeip = ntohl(pdu->fakeip);
-    return ret;
-}
-
-
-/**
- * Parses given status and returns its corresponding status message.
- * @param status Status whose status message will be returned
- * @param Status message
- */
-char*
-parse_socks_status(unsigned char status)
-{
-    switch (status)
-    {
-        case 90:
-            return "Request granted";
-
-        case 91:
-            return "Request rejected/failed - unknown reason";
-
-        case 92:
-            return "Request rejected: SOCKS server cannot connect to identd on the client";
-
-        case 93:
-            return "Request rejected: the client program and identd report different user-ids";
-
-        default:
-            return "Unknown status";
-    }
-}
-
-
-/**
- * Creates a TOR socket.
- * This function creates a TOR socket by establishing a connection to the listening
- * address and port of the TOR client and sending a SOCKS connection request so that
- * a curcuit to the remote host will be created.
- * @param hostname The hostname of the destination
- * @param rport    The port to connect to
- * @return open socket whose traffic will be relayed through TOR or -1 in case of error
+ * Starts a connection to the TOR client without waiting for it.
+ * The returned socket is in non-blocking mode and the connection may
+ * still be in progress. It is established as soon as the socket becomes
+ * writable and no error is pending (see SO_ERROR). Afterwards a SOCKS
+ * connection request has to be sent so that a curcuit to the remote host
+ * will be created.
+ * @return socket whose traffic will be relayed through TOR or -1 in case of error
  */
 int
-create_tor_socket(char* hostname, uint16_t rport)
+connect_tor_async()
 {
     int s;                 // tor socket
-    struct sockaddr_in da; // destination address to connec to
-    socks4a_pdu_t pdu;     // SOCKS request
-    int ret;
+    struct sockaddr_in da; // address of the TOR client
     memset(&da, 0, sizeof(da));
 
     // socket address for connection to the TOR client
@@ -161,49 +64,25 @@ create_tor_socket(char* hostname, uint16_t rport)
     da.sin_family = AF_INET;
     da.sin_port = htons(TOR_PORT);
 
-    // connect to TOR client
-    if ((s = connect_to((struct sockaddr*) &da)) == -1)
-    {
-        ui_log(LOG_ERR, "Could not create TOR socket!");
-        return -1;
-    }
-
-    // craft SOCKS request pdu
-    memset(&pdu, 0, sizeof(pdu));
-    pdu.version = SOCKS_VERSION;
-    pdu.command = SOCKS_CONNECT;
-    pdu.port    = rport;
-    pdu.fakeip  = SOCKS_FAKEIP;
-    pdu.delim   = SOCKS_DELIM;
-    pdu.hostname = hostname;
-
-    // send connection request to TOR
-    if (write_socks4a(s, &pdu) == -1)
-    {
-        ui_log_errno(LOG_ERR, "Could not write SOCKS connection request!");
-        return -1;
-    }
-
-    // read response code from TOR
-    memset(&pdu, 0, sizeof(pdu));
-
-    if ((ret = read_socks4a(s, &pdu)) == -1)
+    if ((s = socket(AF_INET, SOCK_STREAM, 0)) == -1)
     {
-        ui_log(LOG_ERR, "Could not read SOCKS connection response!");
+        ui_log_errno(LOG_ERR, "Could not create TOR socket!");
         return -1;
     }
 
-    if (!ret)
+    if (set_nonblocking(s) == -1)
     {
-        ui_log(LOG_ERR, "Connection to TOR client has been closed!");
+        ui_log_errno(LOG_ERR, "Could not set TOR socket to non-blocking mode!");
+        close(s);
         return -1;
     }
 
-    if (pdu.command != 90)
+    // connect to TOR client
+    if (connect(s, (struct sockaddr*) &da, sizeof(da)) == -1 &&
+        errno != EINPROGRESS)
     {
-        ui_log(LOG_WARN,
-               "TOR Connection to remote host failed. Status code: %d - '%s'", pdu.command,
-               parse_socks_status(pdu.command));
+        ui_log_errno(LOG_ERR, "Could not connect to TOR client!");
+        close(s);
         return -1;
     }
 
@@ -261,6 +140,25 @@ connect_to(struct sockaddr* sa)
 }
 
 
+/**
+ * Puts the given file descriptor into non-blocking mode.
+ * @param fd File descriptor
+ * @return 0 on success, -1 in case of error
+ */
+int
+set_nonblocking(int fd)
+{
+    int flags;
+
+    if ((flags = fcntl(fd, F_GETFL, 0)) == -1)
+    {
+        return -1;
+    }
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+
 /**
  * Checks wether the given port is a valid TCP port.
  * Valid ports are between 1 and 65536.
@@ -313,3 +211,81 @@ is_valid_onion(char* onion_id)
 
     return 1;
 }
+
+
+/**
+ *  Decodes the base32 part of an onion address.
+ *  The 16 base32 characters preceding ".onion" carry 80 bits which
+ *  are stored as ONION_BINLEN bytes. Upper case letters are accepted.
+ *  @param onion_id Valid onion address
+ *  @param bin      Buffer of at least ONION_BINLEN bytes
+ *  @return 0 on success, -1 if the address is not base32 encoded
+ */
+int
+onion_to_bin(const char* onion_id, unsigned char* bin)
+{
+    unsigned buf = 0; // bits not yet stored
+    int bits = 0;     // number of bits in buf
+    int i, v;
+
+    for (i = 0; i < ONION_ADDRLEN - 6; i++)
+    {
+        if (onion_id[i] >= 'a' && onion_id[i] <= 'z')
+        {
+            v = onion_id[i] - 'a';
+        }
+        else if (onion_id[i] >= 'A' && onion_id[i] <= 'Z')
+        {
+            v = onion_id[i] - 'A';
+        }
+        else if (onion_id[i] >= '2' && onion_id[i] <= '7')
+        {
+            v = onion_id[i] - '2' + 26;
+        }
+        else
+        {
+            return -1;
+        }
+
+        buf = (buf << 5) | v;
+        bits += 5;
+
+        if (bits >= 8)
+        {
+            bits -= 8;
+            *bin++ = (buf >> bits) & 0xff;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ *  Encodes a decoded onion address.
+ *  Counterpart of onion_to_bin(), the result is null-terminated.
+ *  @param bin      ONION_BINLEN bytes of a decoded onion address
+ *  @param onion_id Buffer of at least ONION_ADDRLEN + 1 bytes
+ */
+void
+bin_to_onion(const unsigned char* bin, char* onion_id)
+{
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz234567";
+    unsigned buf = 0; // bits not yet encoded
+    int bits = 0;     // number of bits in buf
+    int i;
+
+    for (i = 0; i < ONION_ADDRLEN - 6; i++)
+    {
+        if (bits < 5)
+        {
+            buf = (buf << 8) | *bin++;
+            bits += 8;
+        }
+
+        bits -= 5;
+        onion_id[i] = alphabet[(buf >> bits) & 0x1f];
+    }
+
+    strcpy(&onion_id[i], ".onion");
+}
@@ -122,6 +122,15 @@ init_cli_options(cli_options_t* options)
         OPTION(CLI_OPT_LPRT, CLI_LOPT_LPRT, CLI_OPT_ARG_LPRT, 0, "Set the local listening port.", lprt_parse),
         OPTION(CLI_OPT_RONI, CLI_LOPT_RONI, CLI_OPT_ARG_RONI, 0, "Set the onion id of the remote host to whom a connection should be established.", roni_parse),
         OPTION(CLI_OPT_RPRT, CLI_LOPT_RPRT, CLI_OPT_ARG_RPRT, 0, "Set the remote port of the remote host who will accept connections on this port.", rprt_parse),
+        OPTION(CLI_OPT_QHGH, CLI_LOPT_QHGH, CLI_OPT_ARG_QHGH, 0, "Set the high watermark of a contact's send queue.", qhgh_parse),
+        OPTION(CLI_OPT_QLOW, CLI_LOPT_QLOW, CLI_OPT_ARG_QLOW, 0, "Set the low watermark of a contact's send queue.", qlow_parse),
+        OPTION(CLI_OPT_QTMO, CLI_LOPT_QTMO, CLI_OPT_ARG_QTMO, 0, "Set the seconds a send queue may exceed its high watermark before the contact is disconnected.", qtmo_parse),
+        OPTION(CLI_OPT_WORK, CLI_LOPT_WORK, CLI_OPT_ARG_WORK, 0, "Set the amount of threads handling contacts.", work_parse),
+        OPTION(CLI_OPT_CONN, CLI_LOPT_CONN, CLI_OPT_ARG_CONN, 0, "Set the amount of connection attempts in flight at once.", conn_parse),
+        OPTION(CLI_OPT_CTMO, CLI_LOPT_CTMO, CLI_OPT_ARG_CTMO, 0, "Set the seconds a connection attempt may take.", ctmo_parse),
+        OPTION(CLI_OPT_BWIN, CLI_LOPT_BWIN, CLI_OPT_ARG_BWIN, 0, "Set the milliseconds text messages are collected before they are sent together.", bwin_parse),
+        OPTION(CLI_OPT_BMAX, CLI_LOPT_BMAX, CLI_OPT_ARG_BMAX, 0, "Set the amount of text messages sent together at most.", bmax_parse),
+        OPTION(CLI_OPT_MLEN, CLI_LOPT_MLEN, CLI_OPT_ARG_MLEN, 0, "Set the maximum content-length of a content-type, e.g. text/plain=8192.", mlen_parse),
         OPTION(CLI_OPT_HELP, CLI_LOPT_HELP, CLI_OPT_ARG_HELP, 0, "Display help.", help_parse)
     };
     temp_size = sizeof(temp) / sizeof(temp[0]);
@@ -361,9 +370,8 @@ lprt_parse(char* value, int force)
 /**
  * Parses the terminal command line argument string to a remote
  * onion address and stores it in the global dchat configuration.
- * A fake contact will be created at the index 0 of the contactlist,
- * given that the contactlist is empty, otherwise if its size is 1
- * the onion address (remote address) will be set.
+ * The onion address is stored in the remote contact, to whom a
+ * connection will be established at start.
  * @param value Pointer to argument string
  * @param force If set parsed argument string will override
  *              the corresponding settings in the global config
@@ -371,34 +379,154 @@ lprt_parse(char* value, int force)
  */
 int
 roni_parse(char* value, int force)
+{
+    if (!is_valid_onion(value))
+    {
+        return -1;
+    }
+
+    if (force || !is_valid_onion(_cnf->remote.onion_id))
+    {
+        _cnf->remote.onion_id[0] = '\0';
+        strncat(_cnf->remote.onion_id, value, ONION_ADDRLEN);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/**
+ * Parses the terminal command line argument string to a remote port
+ * and stores it in the global dchat configuration.
+ * The port is stored in the remote contact, to whom a connection
+ * will be established at start.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success, 1 nothing has been done or -1 on error.
+ */
+int
+rprt_parse(char* value, int force)
+{
+    char* term;
+    int rport = (int) strtol(value, &term, 10);
+
+    if (!is_valid_port(rport) || *term != '\0')
+    {
+        return -1;
+    }
+
+    if (force || !is_valid_port(_cnf->remote.lport))
+    {
+        _cnf->remote.lport = rport;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/**
+ * Parses a positive integer option argument.
+ * @param value Pointer to argument string
+ * @return parsed integer or -1 if the argument is invalid
+ */
+int
+parse_positive(char* value)
+{
+    char* term;
+    long n = strtol(value, &term, 10);
+
+    if (*value == '\0' || *term != '\0' || n <= 0 || n > INT_MAX)
+    {
+        return -1;
+    }
+
+    return (int) n;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the high
+ * watermark of send queues and stores it in the global dchat
+ * configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success, 1 nothing has been done or -1 on error.
+ */
+int
+qhgh_parse(char* value, int force)
 {
     int n;
 
-    if (_cnf->cl.used_contacts > 1)
+    if ((n = parse_positive(value)) == -1)
     {
-        return 1;
+        return -1;
     }
 
-    if (!is_valid_onion(value))
+    if (force)
+    {
+        _cnf->qhigh = n;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the low
+ * watermark of send queues and stores it in the global dchat
+ * configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success, 1 nothing has been done or -1 on error.
+ */
+int
+qlow_parse(char* value, int force)
+{
+    int n;
+
+    if ((n = parse_positive(value)) == -1)
     {
         return -1;
     }
 
-    if (!_cnf->cl.used_contacts)
+    if (force)
     {
-        n = add_contact(0); // create fake contact
+        _cnf->qlow = n;
+        return 0;
+    }
 
-        if (n != 0)
-        {
-            ui_log(LOG_ERR, "Creation of fake contact failed!");
-            return -1;
-        }
+    return 1;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the seconds
+ * a send queue may stay congested and stores it in the global dchat
+ * configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success, 1 nothing has been done or -1 on error.
+ */
+int
+qtmo_parse(char* value, int force)
+{
+    int n;
+
+    if ((n = parse_positive(value)) == -1)
+    {
+        return -1;
     }
 
-    if (force || !is_valid_onion(_cnf->cl.contact[n].onion_id))
+    if (force)
     {
-        _cnf->cl.contact[n].onion_id[0] = '\0';
-        strncat(_cnf->cl.contact[n].onion_id, value, ONION_ADDRLEN);
+        _cnf->qtimeout = n;
         return 0;
     }
 
@@ -407,47 +535,85 @@ roni_parse(char* value, int force)
 
 
 /**
- * Parses the terminal command line argument string to a remote port
- * and stores it in the global dchat configuration.
- * A fake contact will be created at the index 0 of the contactlist,
- * given that the contactlist is empty, otherwise if its size is 1
- * the port (remote port) will be set.
+ * Parses the terminal command line argument string to the amount
+ * of event loop threads and stores it in the global dchat
+ * configuration.
  * @param value Pointer to argument string
  * @param force If set parsed argument string will override
  *              the corresponding settings in the global config
  * @return 0 on success, 1 nothing has been done or -1 on error.
  */
 int
-rprt_parse(char* value, int force)
+work_parse(char* value, int force)
 {
-    int n = 0;
-    char* term;
-    int rport = (int) strtol(optarg, &term, 10);
+    int n;
+
+    if ((n = parse_positive(value)) == -1 || n > MAX_WORKERS)
+    {
+        return -1;
+    }
 
-    if (_cnf->cl.used_contacts > 1)
+    if (force)
     {
-        return 1;
+        _cnf->workers = n;
+        return 0;
     }
 
-    if (!is_valid_port(rport) || *term != '\0')
+    return 1;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the amount
+ * of connection attempts in flight at once and stores it in the
+ * global dchat configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success, 1 nothing has been done or -1 on error.
+ */
+int
+conn_parse(char* value, int force)
+{
+    int n;
+
+    if ((n = parse_positive(value)) == -1)
     {
         return -1;
     }
 
-    if (!_cnf->cl.used_contacts)
+    if (force)
     {
-        n = add_contact(0); // create fake contact
+        _cnf->connects = n;
+        return 0;
+    }
 
-        if (n != 0)
-        {
-            ui_log(LOG_ERR, "Creation of fake contact failed!");
-            return -1;
-        }
+    return 1;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the seconds
+ * a connection attempt may take and stores it in the global dchat
+ * configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success, 1 nothing has been done or -1 on error.
+ */
+int
+ctmo_parse(char* value, int force)
+{
+    int n;
+
+    if ((n = parse_positive(value)) == -1)
+    {
+        return -1;
     }
 
-    if (force || !is_valid_port(_cnf->cl.contact[n].lport))
+    if (force)
     {
-        _cnf->cl.contact[n].lport = rport;
+        _cnf->ctimeout = n;
         return 0;
     }
 
@@ -455,6 +621,102 @@ rprt_parse(char* value, int force)
 }
 
 
+/**
+ * Parses the terminal command line argument string to the milliseconds
+ * text messages are batched and stores it in the global dchat
+ * configuration. A window of 0 sends every message immediately.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success, 1 nothing has been done or -1 on error.
+ */
+int
+bwin_parse(char* value, int force)
+{
+    int n;
+
+    if (!strcmp(value, "0"))
+    {
+        n = 0;
+    }
+    else if ((n = parse_positive(value)) == -1)
+    {
+        return -1;
+    }
+
+    if (force)
+    {
+        _cnf->bwindow = n;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/**
+ * Parses the terminal command line argument string to the maximum
+ * amount of text messages per batch and stores it in the global dchat
+ * configuration.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success, 1 nothing has been done or -1 on error.
+ */
+int
+bmax_parse(char* value, int force)
+{
+    int n;
+
+    if ((n = parse_positive(value)) == -1)
+    {
+        return -1;
+    }
+
+    if (force)
+    {
+        _cnf->bmax = n;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/**
+ * Parses the terminal command line argument string to a content-type and
+ * its maximum content-length (TYPE=BYTES) and sets the limit of the
+ * content-type. May be given several times.
+ * @param value Pointer to argument string
+ * @param force If set parsed argument string will override
+ *              the corresponding settings in the global config
+ * @return 0 on success, 1 nothing has been done or -1 on error.
+ */
+int
+mlen_parse(char* value, int force)
+{
+    char name[MAX_HEADER_LEN]; // name of content-type
+    char* sep;                 // separator of name and length
+    int n;
+
+    if ((sep = strchr(value, '=')) == NULL || sep - value >= (int) sizeof(name) ||
+        (n = parse_positive(sep + 1)) == -1)
+    {
+        return -1;
+    }
+
+    memcpy(name, value, sep - value);
+    name[sep - value] = '\0';
+
+    if (force)
+    {
+        return set_content_limit(name, n);
+    }
+
+    return 1;
+}
+
+
 /**
  * Parses the terminal command line string and if it is the
  * help option, the usage of this program will be printed.
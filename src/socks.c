@@ -0,0 +1,177 @@
+/*
+ *  Copyright (c) 2014 Christoph Mahrl
+ *
+ *  This file is part of DChat.
+ *
+ *  DChat is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  DChat is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with DChat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/** @file socks.c
+ *  This file contains the SOCKS4a client used to connect through TOR.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dchat_h/socks.h"
+
+
+/**
+ * Crafts a SOCKS4a connection request into the given buffer.
+ * The request consists of version, command, port, a fake ip address,
+ * an empty user-id, the hostname to connect to and a terminating
+ * delimiter (see SOCKS4a protocol).
+ * @param buf      Buffer the request will be written to
+ * @param size     Size of the buffer
+ * @param hostname Domain name of the host to connect to
+ * @param port     Port of the host to connect to
+ * @return length of the request, -1 if it does not fit into the buffer
+ */
+int
+build_socks4a(char* buf, int size, char* hostname, uint16_t port)
+{
+    int hlen = strlen(hostname); // length of hostname
+    uint16_t rport  = htons(port);
+    uint32_t fakeip = htonl(SOCKS_FAKEIP);
+
+    if (hlen > SOCKS_MAXHOST || 10 + hlen > size)
+    {
+        return -1;
+    }
+
+    buf[0] = SOCKS_VERSION;
+    buf[1] = SOCKS_CONNECT;
+    memcpy(buf + 2, &rport, 2);
+    memcpy(buf + 4, &fakeip, 4);
+    buf[8] = SOCKS_DELIM;
+    memcpy(buf + 9, hostname, hlen);
+    buf[9 + hlen] = SOCKS_DELIM;
+    return 10 + hlen;
+}
+
+
+/**
+ * Writes a SOCKS4a connection request to the given socket.
+ * The request is written with a single syscall. It is sent right after
+ * the connection to the SOCKS server has been established, hence it
+ * always fits into the send buffer of the socket.
+ * @param s        Socket where the request will be written to
+ * @param hostname Domain name of the host to connect to
+ * @param port     Port of the host to connect to
+ * @return 0 on success, -1 in case of error
+ */
+int
+write_socks4a(int s, char* hostname, uint16_t port)
+{
+    char buf[10 + SOCKS_MAXHOST]; // SOCKS request
+    int len;
+
+    if ((len = build_socks4a(buf, sizeof(buf), hostname, port)) == -1)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (write(s, buf, len) != len)
+    {
+        // a partial write would corrupt the request
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            errno = ENOBUFS;
+        }
+
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Reads a SOCKS4a reply from the given socket.
+ * The reply is collected across several calls if it arrives in pieces,
+ * therefore the given reply has to be zeroed before the first call. As
+ * soon as the reply is complete, its fields are converted to host byte
+ * order.
+ * @param s     Socket to read from
+ * @param reply Reply read so far
+ * @return 1 if the reply is complete, 0 if further bytes are missing or
+ *         -1 in case of error or EOF
+ */
+int
+read_socks4a(int s, socks4a_reply_t* reply)
+{
+    int ret;
+
+    if ((ret = read(s, reply->buf + reply->len, SOCKS_REPLYLEN - reply->len)) == -1)
+    {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+
+    if (!ret)
+    {
+        errno = ECONNRESET;
+        return -1;
+    }
+
+    if ((reply->len += ret) < SOCKS_REPLYLEN)
+    {
+        return 0;
+    }
+
+    // first byte is the reply version and always 0
+    reply->status = reply->buf[1];
+    memcpy(&reply->port, reply->buf + 2, 2);
+    memcpy(&reply->ip, reply->buf + 4, 4);
+    reply->port = ntohs(reply->port);
+    reply->ip   = ntohl(reply->ip);
+    return 1;
+}
+
+
+/**
+ * Parses given status and returns its corresponding status message.
+ * @param status Status whose status message will be returned
+ * @param Status message
+ */
+char*
+parse_socks_status(unsigned char status)
+{
+    switch (status)
+    {
+        case 90:
+            return "Request granted";
+
+        case 91:
+            return "Request rejected/failed - unknown reason";
+
+        case 92:
+            return "Request rejected: SOCKS server cannot connect to identd on the client";
+
+        case 93:
+            return "Request rejected: the client program and identd report different user-ids";
+
+        default:
+            return "Unknown status";
+    }
+}
@@ -29,6 +29,13 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dchat_h/util.h"
 
 
 /**
@@ -108,3 +115,173 @@ iszero(void* ptr, int n )
 
     return 1;
 }
+
+
+/**
+ *  Returns the seconds elapsed on a monotonic clock.
+ *  Unlike time(2) the returned value is not affected by changes of
+ *  the system time, thus it can be used to measure timeouts.
+ *  @return seconds of the monotonic clock
+ */
+time_t
+mono_time()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+
+/**
+ *  Returns the current time of the monotonic clock in milliseconds,
+ *  which is suitable to measure durations.
+ *  @return milliseconds of the monotonic clock
+ */
+unsigned long
+mono_msec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ *  Continues a FNV-1a hash over the given bytes. Data received in chunks
+ *  is hashed by passing the result of the previous chunk.
+ *  @param h   FNV_BASIS or hash of the preceding bytes
+ *  @param buf Bytes to hash
+ *  @param len Amount of bytes
+ *  @return hash value
+ */
+unsigned
+fnv1a(unsigned h, const char* buf, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        h = (h ^ (unsigned char) buf[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+
+/**
+ *  Initializes a single-producer/single-consumer ring buffer.
+ *  @param rg    Pointer to ring buffer
+ *  @param esize Size of a slot
+ *  @param size  Amount of slots, must be a power of two
+ *  @param efd   eventfd(2) used to wake up the consumer
+ *  @return 0 on success, -1 on error
+ */
+int
+init_ring(ring_t* rg, int esize, unsigned size, int efd)
+{
+    memset(rg, 0, sizeof(*rg));
+
+    if (!size || (size & (size - 1)) || (rg->buf = calloc(size, esize)) == NULL)
+    {
+        return -1;
+    }
+
+    rg->esize = esize;
+    rg->size = size;
+    rg->efd = efd;
+    return 0;
+}
+
+
+/**
+ *  Frees the slots of a ring buffer. The eventfd(2) is not closed,
+ *  since it may be shared.
+ *  @param rg Pointer to ring buffer
+ */
+void
+free_ring(ring_t* rg)
+{
+    free(rg->buf);
+    rg->buf = NULL;
+}
+
+
+/**
+ *  Copies an element into the next free slot. Must only be called by
+ *  the producer. The consumer is not woken up, so that several elements
+ *  can be pushed before calling ring_notify().
+ *  @param rg Pointer to ring buffer
+ *  @param e  Element of `esize` bytes
+ *  @return 0 on success, -1 if the ring buffer is full
+ */
+int
+ring_push(ring_t* rg, const void* e)
+{
+    unsigned tail = __atomic_load_n(&rg->tail, __ATOMIC_RELAXED);
+
+    if (tail - __atomic_load_n(&rg->head, __ATOMIC_ACQUIRE) == rg->size)
+    {
+        return -1;
+    }
+
+    memcpy(rg->buf + (tail & (rg->size - 1)) * rg->esize, e, rg->esize);
+    // publish the slot after it has been written
+    __atomic_store_n(&rg->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+/**
+ *  Copies the oldest element out of the ring buffer. Must only be called
+ *  by the consumer.
+ *  @param rg Pointer to ring buffer
+ *  @param e  Buffer of `esize` bytes receiving the element
+ *  @return 1 if an element has been popped, 0 if the ring buffer is empty
+ */
+int
+ring_pop(ring_t* rg, void* e)
+{
+    unsigned head = __atomic_load_n(&rg->head, __ATOMIC_RELAXED);
+
+    if (head == __atomic_load_n(&rg->tail, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+
+    memcpy(e, rg->buf + (head & (rg->size - 1)) * rg->esize, rg->esize);
+    // release the slot after it has been read
+    __atomic_store_n(&rg->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+/**
+ *  Wakes up the consumer waiting on the given eventfd(2).
+ *  @param efd eventfd(2) of consumer
+ *  @return 0 on success, -1 on error
+ */
+int
+ring_notify(int efd)
+{
+    uint64_t one = 1;
+
+    return write(efd, &one, sizeof(one)) == sizeof(one) || errno == EAGAIN ? 0 : -1;
+}
+
+
+/**
+ *  Resets the given eventfd(2). The consumer has to drain it before
+ *  popping, otherwise a notification may get lost.
+ *  @param efd eventfd(2) of consumer
+ */
+void
+ring_drain(int efd)
+{
+    uint64_t cnt;
+
+    // EAGAIN: the eventfd(2) is non-blocking and has not been notified
+    while (read(efd, &cnt, sizeof(cnt)) == -1 && errno == EINTR)
+    {
+        continue;
+    }
+}